@@ -46,12 +46,18 @@
 #include "grbl/nvs_buffer.h"
 #include "grbl/protocol.h"
 
+#if FRAMING_ENABLE
+#include "framing.h"
+#endif
+
 #define SPP_RUNNING      (1 << 0)
 #define SPP_CONNECTED    (1 << 1)
 #define SPP_CONGESTED    (1 << 2)
 #define SPP_DISCONNECTED (1 << 3)
 #define BT_TX_QUEUE_ENTRIES 32
 #define BT_TX_BUFFER_SIZE 250
+#define BT_TX_BATCH_SIZE 512    // max bytes per write, BLE notifications are limited to MTU - 3
+#define SPP_TX_BATCH_SIZE 256
 
 #define USE_BT_MUTEX 0
 
@@ -73,27 +79,40 @@ typedef struct {
 
 typedef struct {
     uint16_t length;
-    uint8_t data[1];
+    uint8_t data[BT_TX_BUFFER_SIZE];
 } tx_chunk_t;
 
+typedef struct {
+    bluetooth_settings_t base; // NOTE: stored in the original NVS block, do not change
+    uint8_t mode;              // bluetooth_mode_t, stored in a separate block
+} bt_settings_t;
+
 static enqueue_realtime_command_ptr BTSetRtHandler (enqueue_realtime_command_ptr handler);
 
 static uint32_t connection = 0;
 static bool is_second_attempt = false, is_up = false;
-static bluetooth_settings_t bluetooth;
+static bluetooth_mode_t running_mode = BluetoothMode_Classic;
+static bt_settings_t bluetooth;
+static volatile bluetooth_send_ptr tx_send = NULL;
+static volatile uint16_t tx_max = SPP_TX_BATCH_SIZE;
 static SemaphoreHandle_t tx_busy = NULL;
 static EventGroupHandle_t event_group = NULL;
 static TaskHandle_t polltask = NULL;
-static xQueueHandle tx_queue = NULL;
+static xQueueHandle tx_queue = NULL, tx_free = NULL;
+static tx_chunk_t tx_pool[BT_TX_QUEUE_ENTRIES];
 static portMUX_TYPE tx_flush_mux = portMUX_INITIALIZER_UNLOCKED;
 static char client_mac[18];
 
 static bt_tx_buffer_t txbuffer;
 static stream_rx_buffer_t rxbuffer = {0};
 static stream_rx_buffer_t rxbackup;
-static nvs_address_t nvs_address;
+static nvs_address_t nvs_address, nvs_address_mode = 0;
 static on_report_options_ptr on_report_options;
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
+#if FRAMING_ENABLE
+static frame_decoder_t framing = {0};
+static void BTStreamWrite (const char *data, uint16_t length);
+#endif
 
 static enqueue_realtime_command_ptr BTSetRtHandler (enqueue_realtime_command_ptr handler)
 {
@@ -132,35 +151,47 @@ int16_t BTStreamGetC (void)
     int16_t data;
     uint16_t bptr = rxbuffer.tail;
 
-    if(bptr == rxbuffer.head) {
+#if FRAMING_ENABLE
+    if(framing.response)
+        frame_tx_response(&framing, BTStreamRXFree(), BTStreamWrite);
+#endif
+
+    if(bptr == BUFFER_LOAD(rxbuffer.head)) {
         BT_MUTEX_UNLOCK();
         return -1; // no data available else EOF
     }
 
-    data = rxbuffer.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
+    data = rxbuffer.data[bptr++];                           // Get next character, increment tmp pointer
+    BUFFER_STORE(rxbuffer.tail, bptr & (RX_BUFFER_SIZE - 1)); // and update pointer
 
     BT_MUTEX_UNLOCK();
 
     return data;
 }
 
+// Chunks are taken from a static pool sized to the TX queue, blocks when all are in use.
 static inline bool enqueue_tx_chunk (uint16_t length, uint8_t *data)
 {
-    tx_chunk_t *chunk;
+    tx_chunk_t *chunk = NULL;
 
-    if((chunk = malloc(sizeof(tx_chunk_t) + length))) {
-        chunk->length = length;
-        memcpy(&chunk->data, data, length);
+    if(xQueueReceive(tx_free, &chunk, portMAX_DELAY) == pdTRUE) {
+        chunk->length = min(length, BT_TX_BUFFER_SIZE);
+        memcpy(&chunk->data, data, chunk->length);
         if (xQueueSendToBack(tx_queue, &chunk, portMAX_DELAY) != pdPASS) {
-            free(chunk);
+            xQueueSendToBack(tx_free, &chunk, 0);
             chunk = NULL;
-        }
+        } else
+            xTaskNotifyGive(polltask);
     }
 
     return chunk != NULL;
 }
 
+static inline void release_tx_chunk (tx_chunk_t *chunk)
+{
+    xQueueSendToBack(tx_free, &chunk, 0);
+}
+
 // Since grbl always sends cr/lf terminated strings we can send complete strings to improve throughput
 bool BTStreamPutC (const char c)
 {
@@ -183,6 +214,16 @@ void BTStreamWriteS (const char *data)
         BTStreamPutC(c);
 }
 
+#if FRAMING_ENABLE
+
+// Sends binary data as a separate chunk, used for frame acknowledgements
+static void BTStreamWrite (const char *data, uint16_t length)
+{
+    enqueue_tx_chunk(length, (uint8_t *)data);
+}
+
+#endif
+
 void BTStreamFlush (void)
 {
     BT_MUTEX_LOCK();
@@ -266,110 +307,162 @@ static void flush_tx_queue (void)
 
         while(uxQueueMessagesWaiting(tx_queue)) {
             if(xQueueReceive(tx_queue, &chunk, (TickType_t)0) == pdTRUE)
-                free(chunk);
+                release_tx_chunk(chunk);
         }
 
         portEXIT_CRITICAL(&tx_flush_mux);
     }
 }
 
-static void esp_spp_cb (esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+static const io_stream_t bluetooth_stream = {
+    .type = StreamType_Bluetooth,
+    .state.connected = true,
+    .read = BTStreamGetC,
+    .write = BTStreamWriteS,
+    .write_char = BTStreamPutC,
+    .get_rx_buffer_free = BTStreamRXFree,
+    .reset_read_buffer = BTStreamFlush,
+    .cancel_read_buffer = BTStreamCancel,
+    .set_enqueue_rt_handler = BTSetRtHandler
+};
+
+// Called by the transport when a client is ready to exchange data.
+void bluetooth_connected (const uint8_t *bda, bluetooth_send_ptr send, uint16_t max_length)
+{
+    txbuffer.head = 0;
+#if FRAMING_ENABLE
+    frame_reset(&framing);
+#endif
+    sprintf(client_mac, "%02X:%02X:%02X:%02X:%02X:%02X", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+
+    bluetooth_set_max_length(max_length);
+    xEventGroupSetBits(event_group, SPP_CONGESTED);
+    xSemaphoreGive(tx_busy); // in case the previous connection closed with a write pending
+    tx_send = send;
+
+    stream_connect(&bluetooth_stream);
+
+    hal.stream.write_all("[MSG:BT OK]\r\n");
+}
+
+// Flush TX queue and reenable default stream.
+void bluetooth_disconnected (void)
+{
+    tx_send = NULL;
+    client_mac[0] = '\0';
+    flush_tx_queue();
+    xTaskNotifyGive(polltask); // let TX task release any pending chunk
+    stream_disconnect(&bluetooth_stream);
+}
+
+// Max number of bytes per write, may change during a connection (BLE MTU exchange).
+void bluetooth_set_max_length (uint16_t max_length)
+{
+    tx_max = max(1, min(max_length, BT_TX_BATCH_SIZE));
+}
+
+void bluetooth_rx_data (const uint8_t *data, uint16_t length)
+{
+    char c;
+
+    while(length--) {
+        c = (char)*data++;
+        // discard input if MPG has taken over...
+        if(hal.stream.type != StreamType_MPG) {
+
+#if FRAMING_ENABLE
+            if(frame_rx_byte(&framing, &rxbuffer, c))
+                continue; // consumed by frame decoder
+#endif
+
+            if(c == CMD_TOOL_ACK && !rxbuffer.backup) {
+
+                memcpy(&rxbackup, &rxbuffer, sizeof(stream_rx_buffer_t));
+                rxbuffer.backup = true;
+                rxbuffer.tail = rxbuffer.head;
+                hal.stream.read = BTStreamGetC; // restore normal input
+
+            } else if(!enqueue_realtime_command(c)) {
+#if FRAMING_ENABLE
+                if(framing.enabled)
+                    continue; // plain text is discarded in framed mode
+#endif
+                uint32_t bptr = (rxbuffer.head + 1) & (RX_BUFFER_SIZE - 1);  // Get next head pointer
+
+                if(bptr == BUFFER_LOAD(rxbuffer.tail))  // If buffer full
+                    rxbuffer.overflow = 1;              // flag overflow,
+                else {
+                    rxbuffer.data[rxbuffer.head] = c;   // else add data to buffer
+                    BUFFER_STORE(rxbuffer.head, bptr);  // and update pointer
+                }
+            }
+        }
+    }
+}
+
+void bluetooth_tx_complete (bool congested)
 {
-    static const io_stream_t bluetooth_stream = {
-        .type = StreamType_Bluetooth,
-        .state.connected = true,
-        .read = BTStreamGetC,
-        .write = BTStreamWriteS,
-        .write_char = BTStreamPutC,
-        .get_rx_buffer_free = BTStreamRXFree,
-        .reset_read_buffer = BTStreamFlush,
-        .cancel_read_buffer = BTStreamCancel,
-        .set_enqueue_rt_handler = BTSetRtHandler
-    };
+    if(congested)
+        xEventGroupClearBits(event_group, SPP_CONGESTED);
+    xSemaphoreGive(tx_busy);
+    xTaskNotifyGive(polltask);
+}
 
+void bluetooth_congested (bool congested)
+{
+    if(congested)
+        xEventGroupClearBits(event_group, SPP_CONGESTED);
+    else {
+        xEventGroupSetBits(event_group, SPP_CONGESTED);
+        xTaskNotifyGive(polltask);
+    }
+}
+
+static bool spp_send (const uint8_t *data, uint16_t length)
+{
+    return esp_spp_write(connection, length, (uint8_t *)data) == ESP_OK;
+}
+
+static void esp_spp_cb (esp_spp_cb_event_t event, esp_spp_cb_param_t *param)
+{
     switch (event) {
 
         case ESP_SPP_INIT_EVT:
-            esp_bt_dev_set_device_name(bluetooth.device_name);
+            esp_bt_dev_set_device_name(bluetooth.base.device_name);
             esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
-            esp_spp_start_srv(ESP_SPP_SEC_AUTHENTICATE, ESP_SPP_ROLE_SLAVE, 0, bluetooth.service_name);
+            esp_spp_start_srv(ESP_SPP_SEC_AUTHENTICATE, ESP_SPP_ROLE_SLAVE, 0, bluetooth.base.service_name);
             break;
 
         case ESP_SPP_SRV_OPEN_EVT:
             if(connection == 0) {
                 connection = param->open.handle;
-                txbuffer.head = 0;
-                uint8_t *mac = param->srv_open.rem_bda;
-                sprintf(client_mac, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-                stream_connect(&bluetooth_stream);
-
-                if(eTaskGetState(polltask) == eSuspended)
-                    vTaskResume(polltask);
-
-                hal.stream.write_all("[MSG:BT OK]\r\n");
+                bluetooth_connected(param->srv_open.rem_bda, spp_send, SPP_TX_BATCH_SIZE);
             } else {
                 is_second_attempt = true;
                 esp_spp_disconnect(param->open.handle);
             }
-
             break;
 
         case ESP_SPP_CLOSE_EVT:
             if(is_second_attempt)
                 is_second_attempt = false;
-
-            else { // flush TX queue and reenable default stream
+            else {
                 connection = 0;
-                client_mac[0] = '\0';
-                flush_tx_queue();
-                stream_disconnect(&bluetooth_stream);
+                bluetooth_disconnected();
             }
             break;
 
-        case ESP_SPP_DATA_IND_EVT:;
-            char c;
-            uint16_t len = param->data_ind.len;
-            uint8_t *data = param->data_ind.data;
-
-            while(len--) {
-                c = (char)*data++;
-                // discard input if MPG has taken over...
-                if(hal.stream.type != StreamType_MPG) {
-
-                    if(c == CMD_TOOL_ACK && !rxbuffer.backup) {
-
-                        memcpy(&rxbackup, &rxbuffer, sizeof(stream_rx_buffer_t));
-                        rxbuffer.backup = true;
-                        rxbuffer.tail = rxbuffer.head;
-                        hal.stream.read = BTStreamGetC; // restore normal input
-
-                    } else if(!enqueue_realtime_command(c)) {
-
-                        uint32_t bptr = (rxbuffer.head + 1) & (RX_BUFFER_SIZE - 1);  // Get next head pointer
-
-                        if(bptr == rxbuffer.tail)               // If buffer full
-                            rxbuffer.overflow = 1;              // flag overflow,
-                        else {
-                            rxbuffer.data[rxbuffer.head] = c;   // else add data to buffer
-                            rxbuffer.head = bptr;               // and update pointer
-                        }
-                    }
-                }
-            }
+        case ESP_SPP_DATA_IND_EVT:
+            bluetooth_rx_data(param->data_ind.data, param->data_ind.len);
             break;
 
         case ESP_SPP_CONG_EVT:
-            if(param->cong.cong)
-                xEventGroupClearBits(event_group, SPP_CONGESTED);
-            else
-                xEventGroupSetBits(event_group, SPP_CONGESTED);
+            bluetooth_congested(param->cong.cong);
             ESP_LOGI(SPP_TAG, "ESP_SPP_CONG_EVT");
             break;
 
         case ESP_SPP_WRITE_EVT:
-            if(param->write.cong)
-                xEventGroupClearBits(event_group, SPP_CONGESTED);
-            xSemaphoreGive(tx_busy);
+            bluetooth_tx_complete(param->write.cong);
             break;
 
         default:
@@ -418,54 +511,55 @@ void esp_bt_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param)
     }
 }
 
+// Sleeps until woken by a completed line, a write completion or end of congestion.
+// Queued lines are packed into writes of up to tx_max bytes, a line may be split across writes.
 static void pollTX (void * arg)
 {
     tx_chunk_t *chunk = NULL;
-    bool data_sent = false;
-    uint8_t buffer[256], *ptr;
-    size_t remaining;
+    bool data_sent = true;
+    uint8_t buffer[BT_TX_BATCH_SIZE];
+    uint16_t offset = 0, length, n, max_length;
+    bluetooth_send_ptr send;
 
     while(true) {
 
-        if(connection &&
+        // Retry after a short delay if the last write failed, else wait for work.
+        ulTaskNotifyTake(pdTRUE, data_sent ? portMAX_DELAY : pdMS_TO_TICKS(10));
+
+        send = tx_send;
+
+        if(!send && chunk) { // drop leftover from closed connection
+            release_tx_chunk(chunk);
+            chunk = NULL;
+            offset = 0;
+        }
+
+        data_sent = true;
+
+        if(send &&
             xEventGroupWaitBits(event_group, SPP_CONGESTED, pdFALSE, pdTRUE, 0) &&
-             uxQueueMessagesWaiting(tx_queue) &&
+             (chunk || uxQueueMessagesWaiting(tx_queue)) &&
               xSemaphoreTake(tx_busy, (TickType_t)0)) {
 
-            data_sent = false;
+            length = 0;
+            max_length = tx_max;
 
-            if(chunk || xQueueReceive(tx_queue, &chunk, (TickType_t)0) == pdTRUE) {
+            while(length < max_length && (chunk || xQueueReceive(tx_queue, &chunk, (TickType_t)0) == pdTRUE)) {
 
-                remaining = sizeof(buffer);
-                ptr = buffer;
+                n = min(chunk->length - offset, max_length - length);
+                memcpy(&buffer[length], &chunk->data[offset], n);
+                length += n;
 
-                if(chunk->length >= remaining) {
-                    data_sent = esp_spp_write(connection, chunk->length, chunk->data) == ESP_OK;
-                    free(chunk);
+                if((offset += n) == chunk->length) {
+                    release_tx_chunk(chunk);
                     chunk = NULL;
-                } else while(chunk && chunk->length < remaining) {
-
-                    memcpy(ptr, chunk->data, chunk->length);
-                    ptr += chunk->length;
-                    remaining -= chunk->length;
-                    free(chunk);
-
-                    if(xQueueReceive(tx_queue, &chunk, (TickType_t)0) != pdTRUE)
-                        chunk = NULL;
+                    offset = 0;
                 }
-
-                if(remaining != sizeof(buffer))
-                    data_sent = esp_spp_write(connection, sizeof(buffer) - remaining, buffer) == ESP_OK;
             }
 
-            if(!data_sent)
+            if(!(data_sent = length && send(buffer, length)))
                xSemaphoreGive(tx_busy);
         }
-
-        if(connection)
-            vTaskDelay(pdMS_TO_TICKS(10));
-        else
-            vTaskSuspend(NULL);
     }
 }
 
@@ -473,7 +567,7 @@ bool bluetooth_start (void)
 {
     client_mac[0] = '\0';
 
-    if(bluetooth.device_name[0] == '\0' || !(event_group || (event_group = xEventGroupCreate())))
+    if(bluetooth.base.device_name[0] == '\0' || !(event_group || (event_group = xEventGroupCreate())))
         return false;
 
     xEventGroupClearBits(event_group, 0xFFFFFF);
@@ -487,33 +581,52 @@ bool bluetooth_start (void)
     if(!(tx_queue || (tx_queue = xQueueCreate(BT_TX_QUEUE_ENTRIES, sizeof(tx_chunk_t *)))))
         return false;
 
+    if(tx_free == NULL) {
+
+        if(!(tx_free = xQueueCreate(BT_TX_QUEUE_ENTRIES, sizeof(tx_chunk_t *))))
+            return false;
+
+        tx_chunk_t *chunk;
+        uint_fast8_t idx = BT_TX_QUEUE_ENTRIES;
+
+        do {
+            chunk = &tx_pool[--idx];
+            xQueueSendToBack(tx_free, &chunk, 0);
+        } while(idx);
+    }
+
     if(!(tx_busy || (tx_busy = xSemaphoreCreateBinary())))
         return false;
 
     xSemaphoreGive(tx_busy);
 
     if(polltask == NULL) {
-        if(xTaskCreatePinnedToCore(pollTX, "btTX", 4096, NULL, 2, &polltask, 1) == pdPASS)
-            vTaskSuspend(polltask);
-        else
+        if(xTaskCreatePinnedToCore(pollTX, "btTX", 4096, NULL, 2, &polltask, 1) != pdPASS)
             return false;
     }
 
     if(esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_ENABLED)
         return true;
 
-    if(esp_bt_controller_mem_release(ESP_BT_MODE_BLE) == ESP_OK) {
+    // Memory for the unused controller mode is released, changing mode requires a restart.
+    esp_bt_mode_t mode = bluetooth.mode == BluetoothMode_LE ? ESP_BT_MODE_BLE : ESP_BT_MODE_CLASSIC_BT;
+
+    running_mode = mode == ESP_BT_MODE_BLE ? BluetoothMode_LE : BluetoothMode_Classic;
+
+    if(esp_bt_controller_mem_release(mode == ESP_BT_MODE_BLE ? ESP_BT_MODE_CLASSIC_BT : ESP_BT_MODE_BLE) == ESP_OK) {
 
         esp_err_t ret;
 
         esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
 
+        bt_cfg.mode = mode;
+
         if ((ret = esp_bt_controller_init(&bt_cfg)) != ESP_OK) {
             ESP_LOGE(SPP_TAG, "%s initialize controller failed: %s\n", __func__, esp_err_to_name(ret));
             return false;
         }
 
-        if ((ret = esp_bt_controller_enable(ESP_BT_MODE_CLASSIC_BT)) != ESP_OK) {
+        if ((ret = esp_bt_controller_enable(mode)) != ESP_OK) {
             ESP_LOGE(SPP_TAG, "%s enable controller failed: %s\n", __func__, esp_err_to_name(ret));
             return false;
         }
@@ -528,6 +641,9 @@ bool bluetooth_start (void)
             return false;
         }
 
+        if(mode == ESP_BT_MODE_BLE)
+            return (is_up = bluetooth_le_init(bluetooth.base.device_name));
+
         if ((ret = esp_bt_gap_register_callback(esp_bt_gap_cb)) != ESP_OK) {
             ESP_LOGE(SPP_TAG, "%s gap register failed: %s\n", __func__, esp_err_to_name(ret));
             return false;
@@ -570,10 +686,14 @@ bool bluetooth_disable (void)
 {
     if(esp_bt_controller_get_status() == ESP_BT_CONTROLLER_STATUS_ENABLED) {
 
-        if(connection)
-            esp_spp_disconnect(connection);
+        if(running_mode == BluetoothMode_LE)
+            bluetooth_le_deinit();
+        else {
+            if(connection)
+                esp_spp_disconnect(connection);
+            esp_spp_deinit();
+        }
 
-        esp_spp_deinit();
         esp_bluedroid_disable();
         esp_bluedroid_deinit();
 
@@ -599,7 +719,10 @@ bool bluetooth_disable (void)
             vEventGroupDelete(event_group);
             vSemaphoreDelete(tx_busy);
             vQueueDelete(tx_queue);
-            polltask = event_group = tx_busy = tx_queue = NULL;
+            vQueueDelete(tx_free);
+            polltask = NULL;
+            event_group = NULL;
+            tx_busy = tx_queue = tx_free = NULL;
 #if USE_BT_MUTEX
             vSemaphoreDelete(lock);
             lock = NULL;
@@ -619,15 +742,17 @@ static const setting_group_detail_t bluetooth_groups [] = {
 };
 
 static const setting_detail_t bluetooth_settings[] = {
-    { Setting_BlueToothDeviceName, Group_Bluetooth, "Bluetooth device name", NULL, Format_String, "x(32)", NULL, "32", Setting_NonCore, bluetooth.device_name, NULL, NULL },
-    { Setting_BlueToothServiceName, Group_Bluetooth, "Bluetooth service name", NULL, Format_String, "x(32)", NULL, "32", Setting_NonCore, bluetooth.service_name, NULL, NULL }
+    { Setting_BlueToothDeviceName, Group_Bluetooth, "Bluetooth device name", NULL, Format_String, "x(32)", NULL, "32", Setting_NonCore, bluetooth.base.device_name, NULL, NULL },
+    { Setting_BlueToothServiceName, Group_Bluetooth, "Bluetooth service name", NULL, Format_String, "x(32)", NULL, "32", Setting_NonCore, bluetooth.base.service_name, NULL, NULL },
+    { Setting_BlueToothMode, Group_Bluetooth, "Bluetooth mode", NULL, Format_RadioButtons, "Classic (SPP),Low Energy (GATT)", NULL, NULL, Setting_NonCore, &bluetooth.mode, NULL, NULL }
 };
 
 #ifndef NO_SETTINGS_DESCRIPTIONS
 
 static const setting_descr_t bluetooth_settings_descr[] = {
     { Setting_BlueToothDeviceName, "Bluetooth device name." },
-    { Setting_BlueToothServiceName, "Bluetooth service name." },
+    { Setting_BlueToothServiceName, "Bluetooth service name, not used in Low Energy mode." },
+    { Setting_BlueToothMode, "Classic uses the Serial Port Profile, Low Energy a Nordic UART compatible GATT service." SETTINGS_HARD_RESET_REQUIRED },
 };
 
 #endif
@@ -641,23 +766,36 @@ static error_details_t error_details = {
     .n_errors = sizeof(status_detail) / sizeof(status_detail_t)
 };
 
+static void bluetooth_settings_save (void)
+{
+    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&bluetooth.base, sizeof(bluetooth_settings_t), true);
+
+    if(nvs_address_mode)
+        hal.nvs.memcpy_to_nvs(nvs_address_mode, &bluetooth.mode, sizeof(bluetooth.mode), true);
+}
+
 static void bluetooth_settings_restore (void)
 {
-    strcpy(bluetooth.device_name, BLUETOOTH_DEVICE);
-    strcpy(bluetooth.service_name, BLUETOOTH_SERVICE);
+    strcpy(bluetooth.base.device_name, BLUETOOTH_DEVICE);
+    strcpy(bluetooth.base.service_name, BLUETOOTH_SERVICE);
+    bluetooth.mode = BluetoothMode_Classic;
 
-    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&bluetooth, sizeof(bluetooth_settings_t), true);
+    bluetooth_settings_save();
 }
 
 static void bluetooth_settings_load (void)
 {
-    if(hal.nvs.memcpy_from_nvs((uint8_t *)&bluetooth, nvs_address, sizeof(bluetooth_settings_t), true) != NVS_TransferResult_OK)
+    if(hal.nvs.memcpy_from_nvs((uint8_t *)&bluetooth.base, nvs_address, sizeof(bluetooth_settings_t), true) != NVS_TransferResult_OK)
         bluetooth_settings_restore();
-}
 
-static void bluetooth_settings_save (void)
-{
-    hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&bluetooth, sizeof(bluetooth_settings_t), true);
+    // Mode block is missing on first boot after an upgrade, default to Classic and keep the names.
+    else if(!nvs_address_mode ||
+             hal.nvs.memcpy_from_nvs(&bluetooth.mode, nvs_address_mode, sizeof(bluetooth.mode), true) != NVS_TransferResult_OK ||
+              bluetooth.mode > BluetoothMode_LE) {
+        bluetooth.mode = BluetoothMode_Classic;
+        if(nvs_address_mode)
+            hal.nvs.memcpy_to_nvs(nvs_address_mode, &bluetooth.mode, sizeof(bluetooth.mode), true);
+    }
 }
 
 static setting_details_t setting_details = {
@@ -690,4 +828,14 @@ bool bluetooth_init (void)
     return nvs_address != 0;
 }
 
+// The mode setting is allocated after all plugins so that settings stored
+// by earlier firmware keep their NVS addresses.
+bool bluetooth_mode_init (void)
+{
+    if(nvs_address)
+        nvs_address_mode = nvs_alloc(sizeof(bluetooth.mode));
+
+    return nvs_address_mode != 0;
+}
+
 #endif
@@ -26,9 +26,34 @@
 
 #include "grbl/grbl.h"
 
+// The core reserves Setting_UserDefined_0 - 9 (450 - 459) for driver and plugin settings, the core ids next to
+// the other Bluetooth settings are all taken. None of the reserved ids is used elsewhere in this driver, the last
+// one is picked as third party plugins that use this range usually start from the first.
+#define Setting_BlueToothMode Setting_UserDefined_9
+
+typedef enum {
+    BluetoothMode_Classic = 0,  // Serial Port Profile
+    BluetoothMode_LE            // GATT UART service
+} bluetooth_mode_t;
+
+// Transport interface, the stream and TX batching is shared by the SPP and BLE implementations.
+
+typedef bool (*bluetooth_send_ptr)(const uint8_t *data, uint16_t length);
+
 bool bluetooth_init (void);
+bool bluetooth_mode_init (void);
 bool bluetooth_start (void);
 char *bluetooth_get_device_mac (void);
 char *bluetooth_get_client_mac (void);
 
+void bluetooth_connected (const uint8_t *bda, bluetooth_send_ptr send, uint16_t max_length);
+void bluetooth_disconnected (void);
+void bluetooth_set_max_length (uint16_t max_length);
+void bluetooth_rx_data (const uint8_t *data, uint16_t length);
+void bluetooth_tx_complete (bool congested);
+void bluetooth_congested (bool congested);
+
+bool bluetooth_le_init (const char *device_name);
+void bluetooth_le_deinit (void);
+
 #endif
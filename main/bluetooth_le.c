@@ -0,0 +1,299 @@
+/*
+  bluetooth_le.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Bluetooth Low Energy comms, Nordic UART Service (NUS) compatible GATT server
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Some parts of the code is based on example code by Espressif, in the public domain
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Clients write g-code to the RX characteristic and enable notifications on the TX characteristic
+  to receive output, the stream is connected when notifications are enabled.
+  Output lines are batched into notifications of up to MTU - 3 bytes by the shared Bluetooth TX task,
+  clients should request a large MTU (up to BLE_LOCAL_MTU) for throughput comparable to SPP.
+  Long (prepared) writes are not supported, writes must fit in MTU - 3 bytes.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "esp_bt.h"
+#include "esp_gap_ble_api.h"
+#include "esp_gatts_api.h"
+#include "esp_gatt_common_api.h"
+
+#include "driver.h"
+#include "bluetooth.h"
+
+#define BLE_TAG "BLUETOOTH LE"
+#define BLE_APP_ID 0x55
+#define BLE_LOCAL_MTU 515       // max notification payload is MTU - 3 = 512 bytes
+#define BLE_DATA_LENGTH 251     // max link layer payload, Data Length Extension
+
+#define ADV_CONFIG_FLAG      (1 << 0)
+#define SCAN_RSP_CONFIG_FLAG (1 << 1)
+
+enum {
+    Attr_Service = 0,
+    Attr_RX_Decl,
+    Attr_RX_Value,
+    Attr_TX_Decl,
+    Attr_TX_Value,
+    Attr_TX_CCCD,
+    Attr_Count
+};
+
+// Nordic UART Service UUIDs, little endian
+static const uint8_t service_uuid[ESP_UUID_LEN_128] = { 0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x01, 0x00, 0x40, 0x6E };
+static const uint8_t rx_uuid[ESP_UUID_LEN_128] = { 0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x02, 0x00, 0x40, 0x6E };
+static const uint8_t tx_uuid[ESP_UUID_LEN_128] = { 0x9E, 0xCA, 0xDC, 0x24, 0x0E, 0xE5, 0xA9, 0xE0, 0x93, 0xF3, 0xA3, 0xB5, 0x03, 0x00, 0x40, 0x6E };
+
+static const uint16_t primary_service_uuid = ESP_GATT_UUID_PRI_SERVICE;
+static const uint16_t char_decl_uuid = ESP_GATT_UUID_CHAR_DECLARE;
+static const uint16_t char_client_config_uuid = ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
+static const uint8_t char_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+static const uint8_t char_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t char_value[1] = {0};
+static const uint8_t tx_ccc[2] = {0};
+
+static const esp_gatts_attr_db_t gatt_db[Attr_Count] = {
+    [Attr_Service] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&primary_service_uuid, ESP_GATT_PERM_READ,
+                      sizeof(service_uuid), sizeof(service_uuid), (uint8_t *)service_uuid}},
+
+    [Attr_RX_Decl] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_decl_uuid, ESP_GATT_PERM_READ,
+                      sizeof(uint8_t), sizeof(uint8_t), (uint8_t *)&char_prop_write}},
+
+    [Attr_RX_Value] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)rx_uuid, ESP_GATT_PERM_WRITE,
+                       BLE_LOCAL_MTU - 3, sizeof(char_value), (uint8_t *)char_value}},
+
+    [Attr_TX_Decl] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_decl_uuid, ESP_GATT_PERM_READ,
+                      sizeof(uint8_t), sizeof(uint8_t), (uint8_t *)&char_prop_notify}},
+
+    [Attr_TX_Value] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_128, (uint8_t *)tx_uuid, ESP_GATT_PERM_READ,
+                       BLE_LOCAL_MTU - 3, sizeof(char_value), (uint8_t *)char_value}},
+
+    [Attr_TX_CCCD] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&char_client_config_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE,
+                      sizeof(tx_ccc), sizeof(tx_ccc), (uint8_t *)tx_ccc}}
+};
+
+static esp_ble_adv_data_t adv_data = {
+    .set_scan_rsp = false,
+    .include_name = false,
+    .include_txpower = false,
+    .min_interval = 0x0006,
+    .max_interval = 0x0010,
+    .service_uuid_len = sizeof(service_uuid),
+    .p_service_uuid = (uint8_t *)service_uuid,
+    .flag = (ESP_BLE_ADV_FLAG_GEN_DISC | ESP_BLE_ADV_FLAG_BREDR_NOT_SPT)
+};
+
+// The 128 bit service UUID leaves no room for the name in the advertisement, send it in the scan response
+static esp_ble_adv_data_t scan_rsp_data = {
+    .set_scan_rsp = true,
+    .include_name = true,
+    .include_txpower = true
+};
+
+static esp_ble_adv_params_t adv_params = {
+    .adv_int_min = 0x20,
+    .adv_int_max = 0x40,
+    .adv_type = ADV_TYPE_IND,
+    .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+    .channel_map = ADV_CHNL_ALL,
+    .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY
+};
+
+static const char *device_name;
+static uint8_t adv_config_pending = 0;
+static uint16_t handles[Attr_Count];
+static uint16_t conn_id = 0, mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+static esp_gatt_if_t gatts_if = ESP_GATT_IF_NONE;
+static esp_bd_addr_t remote_bda;
+static bool is_connected = false, stream_open = false;
+
+static bool ble_send (const uint8_t *data, uint16_t length)
+{
+    return esp_ble_gatts_send_indicate(gatts_if, conn_id, handles[Attr_TX_Value], length, (uint8_t *)data, false) == ESP_OK;
+}
+
+static void esp_gap_cb (esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    switch (event) {
+
+        case ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT:
+            if((adv_config_pending &= ~ADV_CONFIG_FLAG) == 0)
+                esp_ble_gap_start_advertising(&adv_params);
+            break;
+
+        case ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT:
+            if((adv_config_pending &= ~SCAN_RSP_CONFIG_FLAG) == 0)
+                esp_ble_gap_start_advertising(&adv_params);
+            break;
+
+        case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
+            if(param->adv_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
+                ESP_LOGE(BLE_TAG, "advertising start failed, status:%d", param->adv_start_cmpl.status);
+            break;
+
+        case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+            ESP_LOGI(BLE_TAG, "connection interval:%d latency:%d", param->update_conn_params.conn_int, param->update_conn_params.latency);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void esp_gatts_cb (esp_gatts_cb_event_t event, esp_gatt_if_t gatt_if, esp_ble_gatts_cb_param_t *param)
+{
+    switch (event) {
+
+        case ESP_GATTS_REG_EVT:
+            if(param->reg.status != ESP_GATT_OK) {
+                ESP_LOGE(BLE_TAG, "app register failed, status:%d", param->reg.status);
+                break;
+            }
+            gatts_if = gatt_if;
+            esp_ble_gap_set_device_name(device_name);
+            adv_config_pending = ADV_CONFIG_FLAG|SCAN_RSP_CONFIG_FLAG;
+            esp_ble_gap_config_adv_data(&adv_data);
+            esp_ble_gap_config_adv_data(&scan_rsp_data);
+            esp_ble_gatts_create_attr_tab(gatt_db, gatt_if, Attr_Count, 0);
+            break;
+
+        case ESP_GATTS_CREAT_ATTR_TAB_EVT:
+            if(param->add_attr_tab.status == ESP_GATT_OK && param->add_attr_tab.num_handle == Attr_Count) {
+                memcpy(handles, param->add_attr_tab.handles, sizeof(handles));
+                esp_ble_gatts_start_service(handles[Attr_Service]);
+            } else
+                ESP_LOGE(BLE_TAG, "create attribute table failed, status:%d", param->add_attr_tab.status);
+            break;
+
+        case ESP_GATTS_CONNECT_EVT:
+            {
+                is_connected = true;
+                conn_id = param->connect.conn_id;
+                mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+                memcpy(remote_bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+
+                // Ask for the shortest connection interval and longest link layer packets the client will accept.
+                esp_ble_conn_update_params_t conn_params = {
+                    .min_int = 0x06,    // x 1.25ms
+                    .max_int = 0x10,    // x 1.25ms
+                    .latency = 0,
+                    .timeout = 400      // x 10ms
+                };
+                memcpy(conn_params.bda, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+                esp_ble_gap_update_conn_params(&conn_params);
+                esp_ble_gap_set_pkt_data_len(param->connect.remote_bda, BLE_DATA_LENGTH);
+            }
+            break;
+
+        case ESP_GATTS_DISCONNECT_EVT:
+            is_connected = false;
+            if(stream_open) {
+                stream_open = false;
+                bluetooth_disconnected();
+            }
+            esp_ble_gap_start_advertising(&adv_params);
+            break;
+
+        case ESP_GATTS_MTU_EVT:
+            mtu = param->mtu.mtu;
+            if(stream_open)
+                bluetooth_set_max_length(mtu - 3);
+            break;
+
+        case ESP_GATTS_WRITE_EVT:
+            if(param->write.is_prep)
+                break;
+
+            if(param->write.handle == handles[Attr_RX_Value]) {
+                if(stream_open)
+                    bluetooth_rx_data(param->write.value, param->write.len);
+            } else if(param->write.handle == handles[Attr_TX_CCCD] && param->write.len == 2) {
+                bool notify = !!(param->write.value[0] & 0x01);
+                if(notify && !stream_open) {
+                    stream_open = true;
+                    bluetooth_connected(remote_bda, ble_send, mtu - 3);
+                } else if(!notify && stream_open) {
+                    stream_open = false;
+                    bluetooth_disconnected();
+                }
+            }
+            break;
+
+        case ESP_GATTS_CONF_EVT: // notification handed over to the controller
+            if(stream_open)
+                bluetooth_tx_complete(false);
+            break;
+
+        case ESP_GATTS_CONGEST_EVT:
+            bluetooth_congested(param->congest.congested);
+            break;
+
+        default:
+            break;
+    }
+}
+
+bool bluetooth_le_init (const char *name)
+{
+    esp_err_t ret;
+
+    device_name = name;
+
+    if ((ret = esp_ble_gatts_register_callback(esp_gatts_cb)) != ESP_OK) {
+        ESP_LOGE(BLE_TAG, "%s gatts register failed: %s\n", __func__, esp_err_to_name(ret));
+        return false;
+    }
+
+    if ((ret = esp_ble_gap_register_callback(esp_gap_cb)) != ESP_OK) {
+        ESP_LOGE(BLE_TAG, "%s gap register failed: %s\n", __func__, esp_err_to_name(ret));
+        return false;
+    }
+
+    if ((ret = esp_ble_gatts_app_register(BLE_APP_ID)) != ESP_OK) {
+        ESP_LOGE(BLE_TAG, "%s app register failed: %s\n", __func__, esp_err_to_name(ret));
+        return false;
+    }
+
+    if ((ret = esp_ble_gatt_set_local_mtu(BLE_LOCAL_MTU)) != ESP_OK)
+        ESP_LOGE(BLE_TAG, "%s set local MTU failed: %s\n", __func__, esp_err_to_name(ret));
+
+    return true;
+}
+
+void bluetooth_le_deinit (void)
+{
+    if(is_connected)
+        esp_ble_gatts_close(gatts_if, conn_id);
+
+    if(stream_open) {
+        stream_open = false;
+        bluetooth_disconnected();
+    }
+
+    if(gatts_if != ESP_GATT_IF_NONE) {
+        esp_ble_gatts_app_unregister(gatts_if);
+        gatts_if = ESP_GATT_IF_NONE;
+    }
+}
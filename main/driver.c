@@ -2103,6 +2103,10 @@ bool driver_init (void)
 
 #include "grbl/plugins_init.h"
 
+#if BLUETOOTH_ENABLE
+    bluetooth_mode_init();
+#endif
+
     // no need to move version check before init - compiler will fail any mismatch for existing entries
     return hal.version == 9;
 }
@@ -74,6 +74,11 @@
 #define KEYPAD_ENABLE 1
 #endif
 
+#ifdef FRAMING_ENABLE
+#undef FRAMING_ENABLE
+#define FRAMING_ENABLE 1
+#endif
+
 #ifdef NETWORKING_ENABLE
 #define WIFI_ENABLE      1
 #define HTTP_ENABLE      0
@@ -129,6 +134,12 @@
 
 static const DRAM_ATTR float FZERO = 0.0f;
 
+// Head/tail access for the single producer/single consumer stream buffers. Producers (interrupt
+// handlers, Bluetooth callbacks) and the consumer (Grbl task) may run on different cores, so the
+// data must be visible before the index that publishes it. See test/ringbuffer for a host test.
+#define BUFFER_LOAD(idx)        __atomic_load_n(&(idx), __ATOMIC_ACQUIRE)
+#define BUFFER_STORE(idx, val)  __atomic_store_n(&(idx), (val), __ATOMIC_RELEASE)
+
 #ifdef NOPROBE
 #define PROBE_ENABLE     0 // No probe input.
 #else
@@ -146,6 +157,10 @@ static const DRAM_ATTR float FZERO = 0.0f;
 #define WIFI_SOFTAP      0
 #endif
 
+#ifndef FRAMING_ENABLE
+#define FRAMING_ENABLE   0 // Framed streaming protocol for serial and Bluetooth streams.
+#endif
+
 #ifndef NETWORKING_ENABLE
 #define WIFI_ENABLE      0
 #endif
@@ -35,6 +35,10 @@
 #include "grbl/hal.h"
 #include "grbl/protocol.h"
 
+#if FRAMING_ENABLE
+#include "framing.h"
+#endif
+
 #define TWO_STOP_BITS_CONF 0x3
 #define ONE_STOP_BITS_CONF 0x1
 #define CONFIG_DISABLE_HAL_LOCKS 1
@@ -56,6 +60,9 @@ typedef struct {
 } uart_t;
 
 static int16_t serialRead (void);
+#if FRAMING_ENABLE
+static void serialWrite (const char *s, uint16_t length);
+#endif
 
 #if CONFIG_DISABLE_HAL_LOCKS
 #define UART_MUTEX_LOCK(u)
@@ -82,6 +89,9 @@ static const DRAM_ATTR uint16_t RX_BUFFER_SIZE_MASK = RX_BUFFER_SIZE - 1;
 static uart_t *uart1 = NULL;
 static stream_rx_buffer_t rxbuffer = {0};
 static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
+#if FRAMING_ENABLE
+static frame_decoder_t framing = {0};
+#endif
 
 #if SERIAL2_ENABLE
 static uart_t *uart2 = NULL;
@@ -138,15 +148,22 @@ IRAM_ATTR static void _uart1_isr (void *arg)
 
         c = uart1->dev->fifo.rw_byte;
 
+#if FRAMING_ENABLE
+        if(frame_rx_byte(&framing, &rxbuffer, (char)c))
+            continue; // consumed by frame decoder
+
+        if(!enqueue_realtime_command(c) && !framing.enabled) {
+#else
         if(!enqueue_realtime_command(c)) {
+#endif
 
             uint32_t bptr = (rxbuffer.head + 1) & RX_BUFFER_SIZE_MASK;  // Get next head pointer
 
-            if(bptr == rxbuffer.tail)                   // If buffer full
+            if(bptr == BUFFER_LOAD(rxbuffer.tail))      // If buffer full
                 rxbuffer.overflow = 1;                  // flag overflow,
             else {
                 rxbuffer.data[rxbuffer.head] = (char)c; // else add data to buffer
-                rxbuffer.head = bptr;                   // and update pointer
+                BUFFER_STORE(rxbuffer.head, bptr);      // and update pointer
             }
         }
     }
@@ -286,11 +303,16 @@ static int16_t serialRead (void)
     int16_t data;
     uint16_t bptr = rxbuffer.tail;
 
-    if(bptr == rxbuffer.head) {;
+#if FRAMING_ENABLE
+    if(framing.response)
+        frame_tx_response(&framing, serialRXFree(), serialWrite);
+#endif
+
+    if(bptr == BUFFER_LOAD(rxbuffer.head)) {;
         return -1; // no data available else EOF
     }
-    data = rxbuffer.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
+    data = rxbuffer.data[bptr++];                           // Get next character, increment tmp pointer
+    BUFFER_STORE(rxbuffer.tail, bptr & (RX_BUFFER_SIZE - 1)); // and update pointer
 
     return data;
 }
@@ -315,6 +337,21 @@ static void serialWriteS (const char *data)
         serialPutC(c);
 }
 
+#if FRAMING_ENABLE
+
+//
+// Writes a number of characters from a buffer to the serial output stream, blocks if buffer full
+//
+static void serialWrite (const char *s, uint16_t length)
+{
+    char *ptr = (char *)s;
+
+    while(length--)
+        serialPutC(*ptr++);
+}
+
+#endif
+
 IRAM_ATTR static void serialFlush (void)
 {
     flush(uart1);
@@ -459,11 +496,11 @@ static void IRAM_ATTR _uart2_isr (void *arg)
 
             uint32_t bptr = (rxbuffer2.head + 1) & RX_BUFFER_SIZE_MASK;  // Get next head pointer
 
-            if(bptr == rxbuffer2.tail)                    // If buffer full
+            if(bptr == BUFFER_LOAD(rxbuffer2.tail))       // If buffer full
                 rxbuffer2.overflow = 1;                   // flag overflow,
             else {
                 rxbuffer2.data[rxbuffer2.head] = (char)c; // else add data to buffer
-                rxbuffer2.head = bptr;                    // and update pointer
+                BUFFER_STORE(rxbuffer2.head, bptr);       // and update pointer
             }
         }
     }
@@ -562,13 +599,13 @@ int16_t static serial2Read (void)
     int16_t data;
     uint16_t bptr = rxbuffer2.tail;
 
-    if(bptr == rxbuffer2.head) {
+    if(bptr == BUFFER_LOAD(rxbuffer2.head)) {
         UART_MUTEX_UNLOCK(uart2);
         return -1; // no data available else EOF
     }
 
-    data = rxbuffer2.data[bptr++];                 // Get next character, increment tmp pointer
-    rxbuffer2.tail = bptr & (RX_BUFFER_SIZE - 1);  // and update pointer
+    data = rxbuffer2.data[bptr++];                             // Get next character, increment tmp pointer
+    BUFFER_STORE(rxbuffer2.tail, bptr & (RX_BUFFER_SIZE - 1)); // and update pointer
     UART_MUTEX_UNLOCK(uart2);
 
     return data;
@@ -0,0 +1,257 @@
+/*
+  framing.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Framed streaming protocol with windowed acknowledgements
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if FRAMING_ENABLE
+
+#include <string.h>
+
+#include "framing.h"
+
+// Dictionary for compressed data frames, payload byte 0x80 + n expands to tokens[n].
+// NOTE: hosts must use the same table, append new entries only!
+static const DRAM_ATTR char tokens[][6] = {
+    "G0", "G1", "G2", "G3", "G4", "G17", "G18", "G19",
+    "G20", "G21", "G28", "G38.2", "G40", "G43", "G49", "G53",
+    "G54", "G80", "G90", "G91", "G94", "M3", "M4", "M5",
+    "M6", "M8", "M9", "M30", " X", " Y", " Z", " A",
+    " B", " C", " F", " S", " I", " J", " K", " P",
+    " R", " T", " H", " L", " Q", "\n"
+};
+
+static const DRAM_ATTR uint8_t n_tokens = sizeof(tokens) / sizeof(tokens[0]);
+
+// The only frame accepted when not in framed mode.
+static const DRAM_ATTR uint8_t hello[FRAME_OVERHEAD] = {
+    FRAME_SOH, FrameType_Hello, FRAME_HELLO_SEQ, 0, FRAME_HELLO_CRC & 0xFF, FRAME_HELLO_CRC >> 8
+};
+
+ISR_CODE uint16_t frame_crc16 (uint16_t crc, uint8_t c)
+{
+    uint_fast8_t i = 8;
+
+    crc ^= (uint16_t)c << 8;
+
+    do {
+        crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    } while(--i);
+
+    return crc;
+}
+
+// Reference encoder, buffer must be at least length + FRAME_OVERHEAD bytes.
+// Returns the number of bytes to transmit.
+uint_fast16_t frame_encode (uint8_t *buffer, frame_type_t type, uint8_t seq, const uint8_t *payload, uint8_t length)
+{
+    uint16_t crc = 0xFFFF;
+    uint8_t *ptr = buffer;
+
+    *ptr++ = FRAME_SOH;
+    crc = frame_crc16(crc, *ptr++ = (uint8_t)type);
+    crc = frame_crc16(crc, *ptr++ = seq);
+    crc = frame_crc16(crc, *ptr++ = length);
+
+    while(length--)
+        crc = frame_crc16(crc, *ptr++ = *payload++);
+
+    *ptr++ = crc & 0xFF;
+    *ptr++ = crc >> 8;
+
+    return ptr - buffer;
+}
+
+ISR_CODE static inline void frame_put (frame_decoder_t *decoder, stream_rx_buffer_t *rxbuffer, char c)
+{
+    uint_fast16_t bptr = (decoder->head + 1) & (RX_BUFFER_SIZE - 1);
+
+    if(bptr == BUFFER_LOAD(rxbuffer->tail))
+        decoder->overflow = true;
+    else {
+        rxbuffer->data[decoder->head] = c;
+        decoder->head = bptr;
+    }
+}
+
+ISR_CODE static inline void frame_respond (frame_decoder_t *decoder, frame_type_t type, uint8_t seq)
+{
+    decoder->response = ((uint16_t)type << 8) | seq;
+}
+
+ISR_CODE static void frame_complete (frame_decoder_t *decoder, stream_rx_buffer_t *rxbuffer)
+{
+    if(decoder->crc != decoder->crc_rx) {
+        if(decoder->enabled)
+            frame_respond(decoder, FrameType_Nak, decoder->expected);
+        return;
+    }
+
+    switch(decoder->type) {
+
+        case FrameType_Hello:
+            decoder->enabled = true;
+            decoder->expected = 0;
+            frame_respond(decoder, FrameType_Hello, 0);
+            break;
+
+        case FrameType_Bye:
+            if(decoder->enabled) {
+                decoder->enabled = false;
+                frame_respond(decoder, FrameType_Ack, decoder->seq);
+            }
+            break;
+
+        case FrameType_Data:
+        case FrameType_DataCompressed:
+            if(!decoder->enabled)
+                break;
+
+            if(decoder->seq != decoder->expected) {
+                // A resent frame already accepted means the ack was lost, repeat it.
+                if((uint8_t)(decoder->expected - decoder->seq - 1) < 128)
+                    frame_respond(decoder, FrameType_Ack, decoder->expected - 1);
+                else
+                    frame_respond(decoder, FrameType_Nak, decoder->expected);
+            } else if(decoder->overflow || rxbuffer->head != decoder->start) // No room or buffer was flushed/cancelled meanwhile
+                frame_respond(decoder, FrameType_Nak, decoder->expected);
+            else {
+                BUFFER_STORE(rxbuffer->head, decoder->head); // Publish payload
+                frame_respond(decoder, FrameType_Ack, decoder->expected++);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Feed a received byte to the decoder, returns true if the byte was consumed.
+// Called from the stream receive interrupt/callback before realtime command handling.
+ISR_CODE bool frame_rx_byte (frame_decoder_t *decoder, stream_rx_buffer_t *rxbuffer, char c)
+{
+    uint8_t b = (uint8_t)c;
+
+    if(decoder->state != FrameState_Idle && hal.get_elapsed_ticks() - decoder->timestamp > FRAME_TIMEOUT)
+        decoder->state = FrameState_Idle;
+
+    // Not in framed mode, pass on anything not part of a handshake.
+    // A SOH breaking off a partial handshake starts a new one.
+    if(!decoder->enabled) {
+        uint_fast8_t idx = decoder->state < FrameState_Payload ? decoder->state : decoder->state - 1;
+        if(b != hello[idx]) {
+            decoder->state = FrameState_Idle;
+            if(b != FRAME_SOH)
+                return false;
+        }
+    }
+
+    switch(decoder->state) {
+
+        case FrameState_Idle:
+            if(b != FRAME_SOH)
+                return false;
+            decoder->timestamp = hal.get_elapsed_ticks();
+            decoder->crc = 0xFFFF;
+            decoder->state = FrameState_Type;
+            break;
+
+        case FrameState_Type:
+            decoder->type = b;
+            decoder->crc = frame_crc16(decoder->crc, b);
+            decoder->state = FrameState_Seq;
+            break;
+
+        case FrameState_Seq:
+            decoder->seq = b;
+            decoder->crc = frame_crc16(decoder->crc, b);
+            decoder->state = FrameState_Length;
+            break;
+
+        case FrameState_Length:
+            decoder->length = b;
+            decoder->count = 0;
+            decoder->overflow = false;
+            decoder->start = decoder->head = rxbuffer->head;
+            decoder->crc = frame_crc16(decoder->crc, b);
+            decoder->state = b ? FrameState_Payload : FrameState_CRCLow;
+            break;
+
+        case FrameState_Payload:
+            decoder->crc = frame_crc16(decoder->crc, b);
+            if(decoder->enabled && !decoder->overflow) {
+                if(b >= 0x80 && decoder->type == FrameType_DataCompressed) {
+                    if((b -= 0x80) < n_tokens) {
+                        const char *token = tokens[b];
+                        while(*token)
+                            frame_put(decoder, rxbuffer, *token++);
+                    } else
+                        decoder->overflow = true; // Unknown token, reject frame
+                } else
+                    frame_put(decoder, rxbuffer, c);
+            }
+            if(++decoder->count == decoder->length)
+                decoder->state = FrameState_CRCLow;
+            break;
+
+        case FrameState_CRCLow:
+            decoder->crc_rx = b;
+            decoder->state = FrameState_CRCHigh;
+            break;
+
+        case FrameState_CRCHigh:
+            decoder->crc_rx |= (uint16_t)b << 8;
+            decoder->state = FrameState_Idle;
+            frame_complete(decoder, rxbuffer);
+            break;
+    }
+
+    return true;
+}
+
+// Transmit pending ack/nak, to be called from the foreground process.
+void frame_tx_response (frame_decoder_t *decoder, uint16_t rx_free, frame_write_ptr write)
+{
+    uint8_t frame[FRAME_OVERHEAD + 4], payload[4], length = 0;
+    uint16_t response = __atomic_exchange_n(&decoder->response, 0, __ATOMIC_ACQ_REL);
+    frame_type_t type = (frame_type_t)(response >> 8);
+
+    if(type == FrameType_None)
+        return;
+
+    if(type == FrameType_Hello) {
+        payload[length++] = FRAME_VERSION;
+        payload[length++] = FRAME_MAX_PAYLOAD;
+    }
+
+    payload[length++] = rx_free & 0xFF;
+    payload[length++] = rx_free >> 8;
+
+    write((char *)frame, frame_encode(frame, type, response & 0xFF, payload, length));
+}
+
+void frame_reset (frame_decoder_t *decoder)
+{
+    memset(decoder, 0, sizeof(frame_decoder_t));
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+  framing.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Framed streaming protocol with windowed acknowledgements
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Frame layout, multi byte values are little endian:
+
+    SOH | type | seq | len | payload[len] | crc16
+
+  crc16 is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over type, seq, len and payload.
+
+  Host -> controller:
+
+    'H' Hello: switches the stream to framed mode and resets the sequence counter to 0.
+        Outside framed mode only the exact frame SOH 'H' '1' 0x00 0x34 0x4E (seq FRAME_HELLO_SEQ, no payload)
+        is recognized, any byte not matching it is handled as plain input. A SOH not matching
+        it starts a new handshake. None of its bytes are realtime commands so these are never
+        held back by the decoder.
+    'B' Bye: returns the stream to plain text mode.
+    'D' Data: payload is g-code text, copied verbatim to the input buffer.
+    'Z' Compressed data: as 'D' but payload bytes >= 0x80 are tokens expanded from a fixed dictionary.
+
+  Controller -> host:
+
+    'H' Hello reply, payload: protocol version, max payload length, input buffer free (2 bytes).
+    'A' Ack, seq is the last frame accepted into the input buffer, payload: input buffer free (2 bytes).
+    'N' Nak, seq is the next frame expected, payload: input buffer free (2 bytes).
+
+  Data frames must be sent in sequence. The host may have as many frames in flight as the
+  (expanded) payloads fit into the free space reported by the last ack, on a nak it resends
+  from the expected frame after the line has been idle for at least FRAME_TIMEOUT ms.
+  Realtime commands are sent as single bytes between frames, not inside them.
+  Bytes outside frames that are not realtime commands are discarded while in framed mode.
+*/
+
+#ifndef _FRAMING_H_
+#define _FRAMING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "grbl/hal.h"
+
+#define FRAME_SOH           0x01
+#define FRAME_VERSION       1
+#define FRAME_HELLO_SEQ     '1'
+#define FRAME_HELLO_CRC     0x4E34  // crc16 of 'H', FRAME_HELLO_SEQ, 0
+#define FRAME_MAX_PAYLOAD   128
+#define FRAME_OVERHEAD      6       // SOH, type, seq, len and crc16
+#define FRAME_TIMEOUT       50      // ms, partially received frames are dropped after this
+
+typedef enum {
+    FrameType_None = 0,
+    FrameType_Hello = 'H',
+    FrameType_Bye = 'B',
+    FrameType_Data = 'D',
+    FrameType_DataCompressed = 'Z',
+    FrameType_Ack = 'A',
+    FrameType_Nak = 'N'
+} frame_type_t;
+
+typedef enum {
+    FrameState_Idle = 0,
+    FrameState_Type,
+    FrameState_Seq,
+    FrameState_Length,
+    FrameState_Payload,
+    FrameState_CRCLow,
+    FrameState_CRCHigh
+} frame_state_t;
+
+typedef void (*frame_write_ptr)(const char *data, uint16_t length);
+
+typedef struct {
+    volatile bool enabled;
+    frame_state_t state;
+    uint8_t type;
+    uint8_t seq;
+    uint8_t length;
+    uint8_t count;
+    uint8_t expected;
+    bool overflow;
+    uint16_t crc;
+    uint16_t crc_rx;
+    uint_fast16_t start;            // input buffer head when the frame started
+    uint_fast16_t head;             // shadow head, published on successful crc check
+    uint32_t timestamp;
+    volatile uint16_t response;     // response pending transmission: type << 8 | seq, 0 if none
+} frame_decoder_t;
+
+uint16_t frame_crc16 (uint16_t crc, uint8_t c);
+uint_fast16_t frame_encode (uint8_t *buffer, frame_type_t type, uint8_t seq, const uint8_t *payload, uint8_t length);
+bool frame_rx_byte (frame_decoder_t *decoder, stream_rx_buffer_t *rxbuffer, char c);
+void frame_tx_response (frame_decoder_t *decoder, uint16_t rx_free, frame_write_ptr write);
+void frame_reset (frame_decoder_t *decoder);
+
+#endif
@@ -21,11 +21,18 @@
   along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
+
 #include "esp_partition.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
 
 #include "nvs.h"
 #include "grbl/hal.h"
+#include "grbl/protocol.h"
+
+#define NVS_COMMIT_DELAY 500 // ms, writes outside a transaction are committed when no more arrive within this time
 
 #ifndef BUFFER_NVSDATA
 #error BUFFER_NVSDATA must be enabled to use flash for settings storage
@@ -38,6 +45,14 @@ static const DRAM_ATTR char ESP_LF = ASCII_CR;
 static const DRAM_ATTR char ESP_QUESTION_MARK = '?';
 static const esp_partition_t *grblNVS = NULL;
 
+// Settings writes are staged in RAM (the nvs buffer) and committed with a single sector erase and write.
+static struct {
+    volatile uint_fast8_t depth;
+    volatile bool pending;
+    uint8_t *source;
+    TimerHandle_t timer;
+} txn = {0};
+
 
 // Strip top bit set characters, control characters except CR and LF and question mark
 static IRAM_ATTR bool nvs_enqueue_realtime_command (char c)
@@ -55,17 +70,39 @@ bool nvsRead (uint8_t *dest)
     return ok;
 }
 
-bool nvsWrite (uint8_t *source)
+// Returns true if the flash content is identical to source, saves an erase cycle if so.
+static bool nvs_unchanged (uint8_t *source)
+{
+    uint8_t buf[128];
+    size_t offset = 0, length;
+
+    while(offset < hal.nvs.size) {
+        length = hal.nvs.size - offset > sizeof(buf) ? sizeof(buf) : hal.nvs.size - offset;
+        if(esp_partition_read(grblNVS, offset, buf, length) != ESP_OK || memcmp(buf, source + offset, length))
+            return false;
+        offset += length;
+    }
+
+    return true;
+}
+
+static bool nvs_write (uint8_t *source)
 {
+    bool ok;
     enqueue_realtime_command_ptr realtime_command_handler;
 
+    txn.pending = false;
+
+    if(grblNVS && nvs_unchanged(source))
+        return true;
+
     // Save and redirect real time command handler here to avoid panic in uart isr
     // due to constants in standard handler residing in flash.
     realtime_command_handler = hal.stream.set_enqueue_rt_handler(nvs_enqueue_realtime_command);
 
-    bool ok = grblNVS &&
-               esp_partition_erase_range(grblNVS, 0, SPI_FLASH_SEC_SIZE) == ESP_OK &&
-                esp_partition_write(grblNVS, 0, (void *)source, hal.nvs.size) == ESP_OK;
+    ok = grblNVS &&
+          esp_partition_erase_range(grblNVS, 0, SPI_FLASH_SEC_SIZE) == ESP_OK &&
+           esp_partition_write(grblNVS, 0, (void *)source, hal.nvs.size) == ESP_OK;
 
     // Restore real time command handler
     hal.stream.set_enqueue_rt_handler(realtime_command_handler);
@@ -73,9 +110,58 @@ bool nvsWrite (uint8_t *source)
     return ok;
 }
 
+static void nvs_commit_deferred (sys_state_t state)
+{
+    if(txn.pending && txn.depth == 0)
+        nvs_write(txn.source);
+}
+
+static void nvs_commit_timeout (TimerHandle_t timer)
+{
+    protocol_enqueue_rt_command(nvs_commit_deferred);
+}
+
+// Stages the data for writing. Inside a transaction it is written by nvsCommit(),
+// else when no more writes arrive within NVS_COMMIT_DELAY so that $ setting batches cost a single erase.
+bool nvsWrite (uint8_t *source)
+{
+    txn.source = source;
+    txn.pending = true;
+
+    if(txn.depth == 0) {
+        if(txn.timer == NULL || xTimerReset(txn.timer, pdMS_TO_TICKS(10)) != pdPASS)
+            return nvs_write(source);
+    }
+
+    return true;
+}
+
+// Starts a transaction, writes are staged until the outermost transaction is committed.
+// Transactions must only be used from the foreground (grbl) task, as the buffered settings
+// are copied to flash by nvs_buffer_sync_physical() there.
+void nvsBeginTransaction (void)
+{
+    txn.depth++;
+}
+
+// Ends a transaction, writes the staged data to flash when the outermost transaction ends.
+bool nvsCommit (void)
+{
+    if(txn.depth && --txn.depth)
+        return true;
+
+    if(txn.timer)
+        xTimerStop(txn.timer, pdMS_TO_TICKS(10));
+
+    return txn.pending ? nvs_write(txn.source) : true;
+}
+
 bool nvsInit (void)
 {
     grblNVS = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "grbl");
 
+    if(txn.timer == NULL)
+        txn.timer = xTimerCreate("nvsCommit", pdMS_TO_TICKS(NVS_COMMIT_DELAY), pdFALSE, NULL, nvs_commit_timeout);
+
     return grblNVS != NULL;
 }
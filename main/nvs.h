@@ -24,3 +24,5 @@
 bool nvsInit(void);
 bool nvsRead (uint8_t *dest);
 bool nvsWrite (uint8_t *source);
+void nvsBeginTransaction (void);
+bool nvsCommit (void);
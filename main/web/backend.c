@@ -45,8 +45,16 @@
 #include <cJSON.h>
 
 #include "backend.h"
+#include "wwwfs.h"
+#include "json_writer.h"
+#include "events.h"
+#include "transfer.h"
+#include "wsstream.h"
 #include "wifi.h"
+#include "nvs.h"
 #include "grbl/report.h"
+#include "grbl/protocol.h"
+#include "grbl/nvs_buffer.h"
 #include "networking/urldecode.h"
 
 #if WEBUI_ENABLE
@@ -61,6 +69,7 @@
 #endif
 
 static httpd_handle_t httpdaemon = NULL;
+static uint_fast8_t sessions_held = 0, sessions_max = 0;
 
 #define MAX_APs 20
 
@@ -76,6 +85,34 @@ static file_server_data_t file_server_data, spiff_fs_data;
 static file_server_data_t sd_fs_data;
 #endif
 
+#define PATH_CACHE_SIZE     16
+#define PATH_CACHE_PATH_MAX 48
+#define PATH_CACHE_TTL      60000 // ms, entries are probed again after this to pick up changes made outside the
+                                  // web server such as SD card swaps, FTP transfers and $F commands.
+
+typedef enum {
+    PathLocation_Unknown = 0,
+    PathLocation_Missing,
+    PathLocation_SDCard,
+    PathLocation_SPIFFS,
+    PathLocation_SPIFFSGzip,    // only the precompressed .gz sibling exists in SPIFFS
+    PathLocation_WWW,
+    PathLocation_Embedded
+} path_location_t;
+
+typedef struct {
+    char path[PATH_CACHE_PATH_MAX];
+    path_location_t location;
+    uint32_t generation;
+    uint32_t created;
+    uint32_t last_used;
+} path_cache_entry_t;
+
+// URI to file location cache for the catch-all GET handler, only accessed from the http server task.
+static path_cache_entry_t path_cache[PATH_CACHE_SIZE] = {0};
+static volatile uint32_t path_cache_generation = 1; // entries from older generations are invalid
+static uint32_t path_cache_clock = 0;
+
 /* Handler to redirect incoming GET request for /index.html to /
  * This can be overridden by uploading file with same name */
 static esp_err_t redirect_html_get_handler(httpd_req_t *req, char *location)
@@ -86,6 +123,26 @@ static esp_err_t redirect_html_get_handler(httpd_req_t *req, char *location)
     return ESP_OK;
 }
 
+/* Sends an asset embedded in flash with its ETag, or an empty 304 response
+ * if the client already holds the current version (If-None-Match) */
+esp_err_t http_send_asset (httpd_req_t *req, const unsigned char *start, const unsigned char *end, const char *etag, const char *cache_control)
+{
+    char match[64];
+    esp_err_t ret;
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", cache_control);
+
+    // The value is copied truncated if too long for the buffer, good enough for matching the first tags.
+    if(((ret = httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match))) == ESP_OK || ret == ESP_ERR_HTTPD_RESULT_TRUNC) &&
+        (strstr(match, etag) || !strcmp(match, "*"))) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    return httpd_resp_send(req, (const char *)start, end - start);
+}
+
 /* Handler to respond with an icon file embedded in flash.
  * Browsers expect to GET website icon at URI /favicon.ico.
  * This can be overridden by uploading file with same name */
@@ -94,9 +151,8 @@ static esp_err_t favicon_get_handler(httpd_req_t *req)
 {
     extern const unsigned char favicon_ico_start[] asm("_binary_favicon_ico_start");
     extern const unsigned char favicon_ico_end[]   asm("_binary_favicon_ico_end");
-    const size_t favicon_ico_size = (favicon_ico_end - favicon_ico_start);
     httpd_resp_set_type(req, "image/x-icon");
-    return httpd_resp_send(req, (const char *)favicon_ico_start, favicon_ico_size);
+    return http_send_asset(req, favicon_ico_start, favicon_ico_end, ETAG(FAVICON_ICO_ETAG), HTTP_CACHE_STATIC);
 }
 
 static esp_err_t index_html_get_handler(httpd_req_t *req)
@@ -106,8 +162,7 @@ static esp_err_t index_html_get_handler(httpd_req_t *req)
 #else
     extern const unsigned char index_html_start[] asm("_binary_index_html_start");
     extern const unsigned char index_html_end[]   asm("_binary_index_html_end");
-    const size_t index_html_size = (index_html_end - index_html_start);
-    return httpd_resp_send(req, (const char *)index_html_start, index_html_size);
+    return http_send_asset(req, index_html_start, index_html_end, ETAG(INDEX_HTML_ETAG), HTTP_CACHE_REVALIDATE);
 #endif
 }
 
@@ -115,7 +170,7 @@ static esp_err_t ap_login_html_get_handler(httpd_req_t *req)
 {
     extern const unsigned char ap_login_html_start[] asm("_binary_ap_login_html_start");
     extern const unsigned char ap_login_html_end[]   asm("_binary_ap_login_html_end");
-    return httpd_resp_send(req, (const char *)ap_login_html_start, ap_login_html_end - ap_login_html_start);
+    return http_send_asset(req, ap_login_html_start, ap_login_html_end, ETAG(AP_LOGIN_HTML_ETAG), HTTP_CACHE_REVALIDATE);
 }
 
 #define IS_FILE_EXT(filename, ext) \
@@ -127,8 +182,18 @@ esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename)
     if(filename && strlen(filename) > 3) {
         if (IS_FILE_EXT(filename, ".pdf"))
             return httpd_resp_set_type(req, "application/pdf");
-        else if (IS_FILE_EXT(filename, ".html"))
+        else if (IS_FILE_EXT(filename, ".html") || IS_FILE_EXT(filename, ".htm"))
             return httpd_resp_set_type(req, "text/html");
+        else if (IS_FILE_EXT(filename, ".css"))
+            return httpd_resp_set_type(req, "text/css");
+        else if (IS_FILE_EXT(filename, ".js"))
+            return httpd_resp_set_type(req, "application/javascript");
+        else if (IS_FILE_EXT(filename, ".json"))
+            return httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+        else if (IS_FILE_EXT(filename, ".svg"))
+            return httpd_resp_set_type(req, "image/svg+xml");
+        else if (IS_FILE_EXT(filename, ".png"))
+            return httpd_resp_set_type(req, "image/png");
         else if (IS_FILE_EXT(filename, ".jpeg") || IS_FILE_EXT(filename, ".jpg"))
             return httpd_resp_set_type(req, "image/jpeg");
         else if (IS_FILE_EXT(filename, ".ico"))
@@ -141,6 +206,83 @@ esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename)
     return httpd_resp_set_type(req, "text/plain");
 }
 
+// Check if client accepts gzip content encoding
+bool http_accepts_gzip (httpd_req_t *req)
+{
+    char encoding[64];
+    esp_err_t ret = httpd_req_get_hdr_value_str(req, "Accept-Encoding", encoding, sizeof(encoding));
+
+    return (ret == ESP_OK || ret == ESP_ERR_HTTPD_RESULT_TRUNC) && strstr(encoding, "gzip");
+}
+
+// Byte range of a file to send, see http_range_prepare().
+typedef struct {
+    size_t offset;
+    size_t length;
+    char content_range[48];
+} http_range_t;
+
+// Handles a single range "bytes=first-last", "bytes=first-" or "bytes=-suffix_length".
+// Malformed and multiple ranges, and ranges with an If-Range validator not matching etag, are ignored
+// so the whole file is sent. Returns false if a 416 response has been sent instead.
+static bool http_range_prepare (httpd_req_t *req, size_t size, const char *etag, http_range_t *range)
+{
+    char value[48], *s = value + 6, *end;
+    bool satisfiable = size != 0;
+    unsigned long first, last = size - 1;
+
+    range->offset = 0;
+    range->length = size;
+
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    httpd_resp_set_hdr(req, "ETag", etag);
+
+    if(httpd_req_get_hdr_value_str(req, "Range", value, sizeof(value)) != ESP_OK || strncmp(value, "bytes=", 6) || strchr(value, ','))
+        return true;
+
+    esp_err_t ret;
+    char validator[24];
+
+    if((ret = httpd_req_get_hdr_value_str(req, "If-Range", validator, sizeof(validator))) != ESP_ERR_NOT_FOUND &&
+         (ret != ESP_OK || strcmp(validator, etag)))
+        return true;
+
+    if(*s == '-') {
+        unsigned long suffix = strtoul(s + 1, &end, 10);
+        if(end == s + 1 || *end)
+            return true;
+        satisfiable &= suffix != 0;
+        first = suffix >= size ? 0 : size - suffix;
+    } else {
+        first = strtoul(s, &end, 10);
+        if(end == s || *end != '-')
+            return true;
+        if(*(s = end + 1)) {
+            last = strtoul(s, &end, 10);
+            if(*end || last < first)
+                return true;
+            last = min(last, size - 1);
+        }
+    }
+
+    if(!satisfiable || first >= size) {
+        sprintf(range->content_range, "bytes */%u", (unsigned int)size);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_set_hdr(req, "Content-Range", range->content_range);
+        httpd_resp_send(req, NULL, 0);
+        return false;
+    }
+
+    range->offset = first;
+    range->length = last - first + 1;
+
+    sprintf(range->content_range, "bytes %lu-%lu/%u", first, last, (unsigned int)size);
+    httpd_resp_set_status(req, "206 Partial Content");
+    httpd_resp_set_hdr(req, "Content-Range", range->content_range);
+
+    return true;
+}
+
 // Fetch and decode value for query key
 char *http_get_key_value (char *qstring, char *key, char *val, size_t val_size)
 {
@@ -216,6 +358,16 @@ static bool getPayload (httpd_req_t *req, char *buf)
     return true;
 }
 
+static size_t spiffs_read (void *handle, char *buf, size_t size)
+{
+    return fread(buf, sizeof(char), size, (FILE *)handle);
+}
+
+static void spiffs_close (void *handle)
+{
+    fclose((FILE *)handle);
+}
+
 esp_err_t spiffs_get_handler (httpd_req_t *req)
 {
     fs_filepath_t filepath;
@@ -238,8 +390,17 @@ esp_err_t spiffs_get_handler (httpd_req_t *req)
 
     FILE *file;
     struct stat st;
+    bool gzip = false;
+    size_t len = strlen(filepath);
+
+    // Prefer a precompressed sibling if the client accepts it
+    if (len + sizeof(".gz") <= sizeof(filepath) && http_accepts_gzip(req)) {
+        strcpy(filepath + len, ".gz");
+        if (!(gzip = stat(filepath, &st) == 0))
+            filepath[len] = '\0';
+    }
 
-    if (stat(filepath, &st) != 0) {
+    if (!gzip && stat(filepath, &st) != 0) {
         /* If file not present on SPIFFS check if URI
          * corresponds to one of the hardcoded paths */
         if (strcmp(filename, "/index.html") == 0) {
@@ -256,13 +417,36 @@ esp_err_t spiffs_get_handler (httpd_req_t *req)
         return ESP_FAIL;
     }
 
+    filepath[len] = '\0'; // content type is from the original name
     set_content_type_from_file(req, filename);
 
+    if (gzip) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+
+    char etag[20];
+    http_range_t range;
+
+    sprintf(etag, "\"%08x%08x\"", (unsigned int)st.st_size, (unsigned int)st.st_mtime);
+
+    if (!http_range_prepare(req, st.st_size, etag, &range) || (range.offset && fseek(file, range.offset, SEEK_SET) != 0)) {
+        fclose(file);
+        return range.offset ? httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file") : ESP_OK;
+    }
+
+    if (range.length >= TRANSFER_MIN_SIZE) {
+        esp_err_t ret = transfer_start(req, range.length, file, spiffs_read, spiffs_close);
+        if (ret != ESP_ERR_NOT_FOUND)
+            return ret;
+    }
+
     size_t chunksize;
     char *chunk = ((file_server_data_t *)req->user_ctx)->scratch;
 
     do {
-        chunksize = fread(chunk, sizeof(char), sizeof(fs_scratch_t), file);
+        chunksize = fread(chunk, sizeof(char), min(range.length, sizeof(fs_scratch_t)), file);
+        range.length -= chunksize;
 
         if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
             fclose(file);
@@ -281,6 +465,19 @@ esp_err_t spiffs_get_handler (httpd_req_t *req)
 
 #if SDCARD_ENABLE
 
+static size_t sdcard_read (void *handle, char *buf, size_t size)
+{
+    UINT length;
+
+    return f_read((FIL *)handle, buf, size, &length) == FR_OK ? length : 0;
+}
+
+static void sdcard_close (void *handle)
+{
+    f_close((FIL *)handle);
+    free(handle);
+}
+
 static esp_err_t sdcard_get_handler (httpd_req_t *req)
 {
     fs_filepath_t filepath;
@@ -323,11 +520,34 @@ static esp_err_t sdcard_get_handler (httpd_req_t *req)
 
     set_content_type_from_file(req, filename);
 
+    char etag[20];
+    http_range_t range;
+
+    sprintf(etag, "\"%08x%04x%04x\"", (unsigned int)st.fsize, st.fdate, st.ftime);
+
+    if (!http_range_prepare(req, st.fsize, etag, &range) || (range.offset && f_lseek(&file, range.offset) != FR_OK)) {
+        f_close(&file);
+        return range.offset ? httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file") : ESP_OK;
+    }
+
+    FIL *async;
+
+    // The file object holds no pointers to itself so it can be moved to the heap for the transfer.
+    if (range.length >= TRANSFER_MIN_SIZE && (async = malloc(sizeof(FIL)))) {
+        memcpy(async, &file, sizeof(FIL));
+        esp_err_t ret = transfer_start(req, range.length, async, sdcard_read, sdcard_close);
+        if (ret != ESP_ERR_NOT_FOUND)
+            return ret;
+        free(async);
+    }
+
     size_t chunksize;
     char *chunk = ((file_server_data_t *)req->user_ctx)->scratch;
 
     do {
-        f_read(&file, chunk, sizeof(fs_scratch_t), &chunksize);
+        if (f_read(&file, chunk, min(range.length, sizeof(fs_scratch_t)), &chunksize) != FR_OK)
+            chunksize = 0;
+        range.length -= chunksize;
         if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
             f_close(&file);
             httpd_resp_sendstr_chunk(req, NULL);
@@ -378,6 +598,8 @@ static esp_err_t sdcard_form_upload_handler (httpd_req_t *req)
 
     } while(upload->state != Upload_Complete);
 
+    http_path_cache_invalidate();
+
     if(ok) {
         httpd_resp_set_status(req, "202 Accepted");
         httpd_resp_send(req, NULL, 0);
@@ -399,6 +621,120 @@ static esp_err_t sdcard_form_upload_handler (httpd_req_t *req)
 
 #endif //SDCARD_ENABLE
 
+// Serve file from the memory mapped asset partition, no intermediate copy is made.
+// Compressed assets are only sent to clients accepting gzip, others get 406.
+static esp_err_t www_get_handler (httpd_req_t *req, const char *filename, wwwfs_file_t *file)
+{
+    char etag[11];
+
+    if (file->gzipped) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+        if (!http_accepts_gzip(req)) {
+            httpd_resp_set_status(req, "406 Not Acceptable");
+            httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+            return httpd_resp_sendstr(req, "Only available gzip encoded\n");
+        }
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+
+    sprintf(etag, "\"%08x\"", file->crc32);
+    set_content_type_from_file(req, filename);
+
+    return http_send_asset(req, (const unsigned char *)file->data, (const unsigned char *)file->data + file->length, etag, HTTP_CACHE_REVALIDATE);
+}
+
+// Invalidate all cached locations, to be called when files are added or removed.
+void http_path_cache_invalidate (void)
+{
+    path_cache_generation++;
+}
+
+// Current cache generation, other caches of filesystem content may compare against it to detect changes.
+uint32_t http_path_cache_generation (void)
+{
+    return path_cache_generation;
+}
+
+static path_location_t path_cache_get (const char *path)
+{
+    uint32_t now = hal.get_elapsed_ticks(), generation = path_cache_generation;
+    uint_fast8_t idx = PATH_CACHE_SIZE;
+
+    do {
+        path_cache_entry_t *entry = &path_cache[--idx];
+        if(entry->generation == generation && now - entry->created < PATH_CACHE_TTL && !strcmp(entry->path, path)) {
+            entry->last_used = ++path_cache_clock;
+            return entry->location;
+        }
+    } while(idx);
+
+    return PathLocation_Unknown;
+}
+
+// Paths too long for an entry are not cached, the least recently used or an invalid entry is replaced.
+static void path_cache_put (const char *path, path_location_t location)
+{
+    if(strlen(path) >= PATH_CACHE_PATH_MAX)
+        return;
+
+    uint32_t generation = path_cache_generation;
+    uint_fast8_t idx = PATH_CACHE_SIZE;
+    path_cache_entry_t *entry, *victim = &path_cache[0];
+
+    do {
+        entry = &path_cache[--idx];
+        if(entry->generation != generation) {
+            victim = entry;
+            break;
+        }
+        if(entry->last_used < victim->last_used)
+            victim = entry;
+    } while(idx);
+
+    strcpy(victim->path, path);
+    victim->location = location;
+    victim->generation = generation;
+    victim->created = hal.get_elapsed_ticks();
+    victim->last_used = ++path_cache_clock;
+}
+
+// Probe the read only asset sources, name as for locate_file().
+static path_location_t locate_asset (const char *name)
+{
+    // If file exists in the asset partition get it from there
+    wwwfs_file_t www;
+    if (wwwfs_find(name, &www))
+        return PathLocation_WWW;
+
+    if (!strcmp(name, "/index.html") || !strcmp(name, "/favicon.ico"))
+        return PathLocation_Embedded;
+
+    return PathLocation_Missing;
+}
+
+// Probe filesystems in priority order, name is the path to look up for embedded content ("/" mapped to "/index.html").
+static path_location_t locate_file (const char *filename, const char *name)
+{
+#if SDCARD_ENABLE
+    // If file exists on SD card get it from there
+    FILINFO file;
+    if(f_stat(filename, &file) == FR_OK)
+        return PathLocation_SDCard;
+#endif
+
+    // If file exists in spiffs get it from there
+    struct stat st;
+    strcat(strcpy(spiff_fs_data.scratch, spiff_fs_data.base_path), filename);
+
+    if (stat(spiff_fs_data.scratch, &st) == 0)
+        return PathLocation_SPIFFS;
+
+    if (stat(strcat(spiff_fs_data.scratch, ".gz"), &st) == 0)
+        return PathLocation_SPIFFSGzip;
+
+    return locate_asset(name);
+}
+
 static esp_err_t get_handler(httpd_req_t *req)
 {
     if(wifi_dns_running()) { // captive portal, redirect requests to ourself...
@@ -441,31 +777,50 @@ static esp_err_t get_handler(httpd_req_t *req)
     fs_filepath_t filepath;
     const char *filename = get_path_from_uri(filepath, req, sizeof(filepath));
 
-#if SDCARD_ENABLE
-    // If file exists on SD card get it from there
-    FILINFO file;
-    if(f_stat(filename, &file) == FR_OK) {
-#if WEBUI_ENABLE
-        req->user_ctx = &sd_fs_data;
-#endif
-        return sdcard_get_handler(req);
+    if(filename == NULL) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
     }
+
+    path_location_t location;
+    const char *name = strcmp(filename, "/") ? filename : "/index.html";
+
+    if((location = path_cache_get(filename)) == PathLocation_Unknown)
+        path_cache_put(filename, (location = locate_file(filename, name)));
+
+    // The location is cached for all clients, those not accepting gzip get the file from further down the list.
+    if(location == PathLocation_SPIFFSGzip && !http_accepts_gzip(req))
+        location = locate_asset(name);
+
+    switch(location) {
+
+#if SDCARD_ENABLE
+        case PathLocation_SDCard:
+  #if WEBUI_ENABLE
+            req->user_ctx = &sd_fs_data;
+  #endif
+            return sdcard_get_handler(req);
 #endif
 
-    // If file exists in spiffs get it from there
-    struct stat st;
-    strcat(strcpy(spiff_fs_data.scratch, spiff_fs_data.base_path), filename);
+        case PathLocation_SPIFFS:
+        case PathLocation_SPIFFSGzip:
+            req->user_ctx = &spiff_fs_data;
+            return spiffs_get_handler(req);
 
-    if (stat(spiff_fs_data.scratch, &st) == 0) {
-        req->user_ctx = &spiff_fs_data;
-        return spiffs_get_handler(req);
-    }
+        case PathLocation_WWW:
+            {
+                wwwfs_file_t www;
+                if (wwwfs_find(name, &www))
+                    return www_get_handler(req, name, &www);
+            }
+            break;
 
-    if (!strcmp(req->uri, "/index.html") || !strcmp(req->uri, "/"))
-        return index_html_get_handler(req);
+        case PathLocation_Embedded:
+            return strcmp(filename, "/favicon.ico") ? index_html_get_handler(req) : favicon_get_handler(req);
 
-    if (!strcmp(req->uri, "/favicon.ico"))
-        return favicon_get_handler(req);
+        default:
+            break;
+    }
 
     httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
 
@@ -475,57 +830,108 @@ static esp_err_t get_handler(httpd_req_t *req)
 // add setting to the JSON response array
 static bool report_setting (const setting_detail_t *setting, uint_fast16_t offset, void *data)
 {
-    bool ok = true;
+    json_writer_t *json = (json_writer_t *)data;
 
-    cJSON *settingobj;
+    json_start_object(json, NULL);
+    json_add_int(json, "id", (int32_t)(setting->id + offset));
+    json_add_string(json, "value", setting_get_value(setting, offset));
+    json_end_object(json);
 
-    if((ok = (settingobj = cJSON_CreateObject()) != NULL))
-    {
-        ok = !!cJSON_AddNumberToObject(settingobj, "id", (double)(setting->id + offset));
-        ok &= !!cJSON_AddStringToObject(settingobj, "value", setting_get_value(setting, offset));
-        if(ok)
-            cJSON_AddItemToArray((cJSON *)data, settingobj);
-    }
-
-    return ok;
+    return json->ok;
 }
 
 static esp_err_t settings_get_handler(httpd_req_t *req)
 {
-    bool ok;
-
 //  size_t ql = httpd_req_get_url_query_len(req);
 
     int setting = strlen(req->uri) > 9 ? atoi(&req->uri[10]) : -1;
+    json_writer_t writer, *json = &writer;
 
-    cJSON *json_settings, *root = cJSON_CreateObject();
+    json_writer_init_http(json, req);
 
-    if((ok = (root && (json_settings = cJSON_AddArrayToObject(root, "settings"))))) {
+    json_start_object(json, NULL);
+    json_start_array(json, "settings");
 
-        setting_output_ptr org_ptr = grbl.report.setting;
-        grbl.report.setting = report_setting;
+    setting_output_ptr org_ptr = grbl.report.setting;
+    grbl.report.setting = report_setting;
 
-        if(setting == -1)
-            report_grbl_settings(false, &json_settings);
-        else
-            report_grbl_setting((setting_id_t)setting, &json_settings);
+    if(setting == -1)
+        report_grbl_settings(false, json);
+    else
+        report_grbl_setting((setting_id_t)setting, json);
 
-        grbl.report.setting = org_ptr;
+    grbl.report.setting = org_ptr;
 
-        char *resp = cJSON_PrintUnformatted(root);
+    json_end_array(json);
+    json_end_object(json);
 
-        httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-        httpd_resp_send(req, resp, strlen(resp));
+    return json_writer_end(json) ? ESP_OK : ESP_FAIL;
+}
 
-        free(resp);
+typedef struct {
+    setting_id_t id;
+    char *value;
+} saved_setting_t;
+
+// Batch of settings to be stored by the foreground task, the server task waits for the result.
+static struct {
+    cJSON *settings;
+    status_code_t status;
+    SemaphoreHandle_t done;
+} settings_batch = {0};
+
+// Runs in the foreground (grbl) task. Either all settings are stored and written to flash
+// with a single write or the previous values are put back.
+static void settings_store_batch (sys_state_t state)
+{
+    cJSON *setting;
+    uint_fast16_t n = 0, saved_count = 0;
+    status_code_t status = Status_OK;
+    saved_setting_t *saved = calloc(cJSON_GetArraySize(settings_batch.settings) + 1, sizeof(saved_setting_t));
 
-    } else
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to generate response");
+    if(saved == NULL)
+        status = Status_SettingWriteFail;
 
-    if(root)
-        cJSON_Delete(root);
+    else {
 
-    return ok ? ESP_OK : ESP_FAIL;
+        nvsBeginTransaction();
+
+        cJSON_ArrayForEach(setting, settings_batch.settings)
+        {
+            setting_id_t id = (setting_id_t)cJSON_GetObjectItemCaseSensitive(setting, "id")->valueint;
+            const setting_detail_t *details = setting_get_details(id, NULL);
+            char *value = details ? setting_get_value(details, id - details->id) : NULL;
+
+            saved[saved_count].id = id;
+            saved[saved_count++].value = value ? strdup(value) : NULL;
+
+            if((status = settings_store_setting(id, cJSON_GetObjectItemCaseSensitive(setting, "value")->valuestring)) != Status_OK)
+                break;
+
+            n++;
+        }
+
+        // Restore the settings already stored in reverse order if one failed.
+        if(status != Status_OK) while(n--) {
+            if(saved[n].value)
+                settings_store_setting(saved[n].id, saved[n].value);
+        }
+
+        // With BUFFER_NVSDATA settings are stored in RAM, flush them into the transaction.
+        nvs_buffer_sync_physical();
+
+        if(!nvsCommit() && status == Status_OK)
+            status = Status_SettingWriteFail;
+
+        while(saved_count--) {
+            if(saved[saved_count].value)
+                free(saved[saved_count].value);
+        }
+        free(saved);
+    }
+
+    settings_batch.status = status;
+    xSemaphoreGive(settings_batch.done);
 }
 
 static esp_err_t settings_set_handler(httpd_req_t *req)
@@ -545,26 +951,42 @@ static esp_err_t settings_set_handler(httpd_req_t *req)
         status_code_t status = Status_InvalidStatement;
 
         if((ok = (root = cJSON_Parse(buf)))) {
+
             settings = cJSON_GetObjectItemCaseSensitive(root, "settings");
+
+            // Validate all entries before changing anything
             cJSON_ArrayForEach(setting, settings)
             {
                 cJSON *id = cJSON_GetObjectItemCaseSensitive(setting, "id");
                 cJSON *value = cJSON_GetObjectItemCaseSensitive(setting, "value");
 
-                if((status = settings_store_setting ((setting_id_t)((int)id->valuedouble), value->valuestring)) != Status_OK)
+                if(!(ok = cJSON_IsNumber(id) && cJSON_IsString(value) && setting_get_details((setting_id_t)id->valueint, NULL)))
                     break;
             }
+
+            // then let the foreground task store them
+            if(ok && (settings_batch.done || (settings_batch.done = xSemaphoreCreateBinary()))) {
+                settings_batch.settings = settings;
+                if(protocol_enqueue_rt_command(settings_store_batch)) {
+                    xSemaphoreTake(settings_batch.done, portMAX_DELAY);
+                    status = settings_batch.status;
+                }
+            }
+
             cJSON_Delete(root);
         }
 
         if(!ok)
             ESP_LOGE(TAG, "Failed to parse %s!", buf);
 
-        if(ok) {
+        if(!ok)
+            httpd_resp_send_err(req, 400, "Invalid JSON data");
+        else if(status != Status_OK)
+            httpd_resp_send_err(req, 400, "Invalid or unknown setting");
+        else {
             httpd_resp_set_status(req, "202 Accepted");
             httpd_resp_send(req, NULL, 0);
-        } else
-            httpd_resp_send_err(req, 400, "Invalid JSON data");
+        }
     }
 
     if(buf)
@@ -596,51 +1018,36 @@ static esp_err_t wifi_scan_handler (httpd_req_t *req)
 
     if(ap_list && ap_list->ap_records) {
 
-        cJSON *root;
-
-        if((root = cJSON_CreateObject())) {
+        json_writer_t writer, *json = &writer;
 
-            cJSON *ap, *aps;
-
-            ok = cJSON_AddStringToObject(root, "ap", ap_list->ap_selected ? (char *)ap_list->ap_selected : "") != NULL;
-            ok &= cJSON_AddStringToObject(root, "status", ap_list->ap_status) != NULL;
-
-            if(ap_list->ap_selected)
-                cJSON_AddStringToObject(root, "ip", ip4addr_ntoa(&ap_list->ip_addr));
-
-            if((aps = cJSON_AddArrayToObject(root, "aplist"))) {
-
-                for(int i = 0; i < ap_list->ap_num; i++) {
-                    if((ok = (ap = cJSON_CreateObject()) != NULL))
-                    {
-                        ok = cJSON_AddStringToObject(ap, "ssid", (char *)ap_list->ap_records[i].ssid) != NULL;
-                        ok &= cJSON_AddStringToObject(ap, "security", getAuthModeName(ap_list->ap_records[i].authmode)) != NULL;
-                        ok &= cJSON_AddNumberToObject(ap, "primary", (double)ap_list->ap_records[i].primary) != NULL;
-                        ok &= cJSON_AddNumberToObject(ap, "rssi",  (double)ap_list->ap_records[i].rssi) != NULL;
-                        if(ok)
-                            cJSON_AddItemToArray(aps, ap);
-                    }
-                }
-            }
-
-            if(ok) {
-                char *resp = cJSON_PrintUnformatted(root);
 #if xCORS_ENABLE
-                httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-                httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "POST,GET,OPTIONS");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+        httpd_resp_set_hdr(req, "Access-Control-Allow-Methods", "POST,GET,OPTIONS");
 #endif
-                httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-                httpd_resp_send(req, resp, strlen(resp));
+        json_writer_init_http(json, req);
 
-                free(resp);
-            }
+        json_start_object(json, NULL);
+        json_add_string(json, "ap", ap_list->ap_selected ? (char *)ap_list->ap_selected : "");
+        json_add_string(json, "status", ap_list->ap_status);
+
+        if(ap_list->ap_selected)
+            json_add_string(json, "ip", ip4addr_ntoa(&ap_list->ip_addr));
 
-            if(root)
-                cJSON_Delete(root);
+        json_start_array(json, "aplist");
+
+        for(int i = 0; i < ap_list->ap_num; i++) {
+            json_start_object(json, NULL);
+            json_add_string(json, "ssid", (char *)ap_list->ap_records[i].ssid);
+            json_add_string(json, "security", getAuthModeName(ap_list->ap_records[i].authmode));
+            json_add_int(json, "primary", ap_list->ap_records[i].primary);
+            json_add_int(json, "rssi", ap_list->ap_records[i].rssi);
+            json_end_object(json);
         }
 
-        if(!ok)
-            httpd_resp_send_500(req);
+        json_end_array(json);
+        json_end_object(json);
+
+        ok = json_writer_end(json);
     }
 
     if(ap_list)
@@ -792,11 +1199,29 @@ static const httpd_uri_t basic_handlers[] = {
       .handler  = webui_http_command_handler,
       .user_ctx = NULL
     },
+    { .uri      = "/command",
+      .method   = HTTP_POST,
+      .handler  = webui_http_command_handler,
+      .user_ctx = NULL
+    },
     { .uri      = "/login",
       .method   = HTTP_GET,
       .handler  = webui_login_handler,
       .user_ctx = NULL
     },
+    { .uri      = "/events",
+      .method   = HTTP_GET,
+      .handler  = events_get_handler,
+      .user_ctx = NULL
+    },
+  #if CONFIG_HTTPD_WS_SUPPORT
+    { .uri      = "/ws",
+      .method   = HTTP_GET,
+      .handler  = wsstream_handler,
+      .user_ctx = NULL,
+      .is_websocket = true
+    },
+  #endif
 #endif
 #if CORS_ENABLE
     { .uri      = "/wifi",
@@ -838,12 +1263,39 @@ void register_basic_handlers(httpd_handle_t hd)
 
 void httpdaemon_stop (void)
 {
+    events_stop();
+    transfer_stop();
+#if CONFIG_HTTPD_WS_SUPPORT
+    wsstream_stop();
+#endif
+
     if(httpdaemon)
         httpd_stop(httpdaemon);
 
     httpdaemon = NULL;
 }
 
+// Event streams, the websocket console and download transfers keep their socket after the handler has
+// returned. They must hold a session slot, limited so that HTTPD_SOCKETS_RESERVED sockets are always
+// left for other requests. LRU purging is not used as it would drop these sessions first.
+// Only to be called from the server task, handlers and session free callbacks run there.
+bool http_session_hold (void)
+{
+    if(sessions_held >= sessions_max)
+        return false;
+
+    sessions_held++;
+
+    return true;
+}
+
+// Releases a slot acquired with http_session_hold(), called when the session is closed.
+void http_session_release (void)
+{
+    if(sessions_held)
+        sessions_held--;
+}
+
 bool httpdaemon_start (network_settings_t *network)
 {
     //pre_start_mem = esp_get_free_heap_size();
@@ -860,12 +1312,17 @@ bool httpdaemon_start (network_settings_t *network)
     /* This check should be a part of http_server */
     config.max_open_sockets = (CONFIG_LWIP_MAX_SOCKETS - 3);
 
+    sessions_held = 0;
+    sessions_max = config.max_open_sockets > HTTPD_SOCKETS_RESERVED ? config.max_open_sockets - HTTPD_SOCKETS_RESERVED : 0;
+
     *file_server_data.base_path = '\0';
     strcpy(spiff_fs_data.base_path, "/spiffs");
 #if WEBUI_ENABLE
     strcpy(sd_fs_data.base_path, "/SD");
 #endif
 
+    wwwfs_mount();
+
     if (httpd_start(&httpdaemon, &config) == ESP_OK)
         register_basic_handlers(httpdaemon);
 
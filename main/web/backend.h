@@ -32,6 +32,15 @@
 #include "driver.h"
 
 #define SCRATCH_BUFSIZE  8192
+#define HTTPD_SOCKETS_RESERVED 3    // sockets never held by long lived sessions, left for ordinary requests and logins
+
+// Embedded assets are not served from fingerprinted URLs, so documents are always revalidated
+// (a cheap 304 response when unchanged) while static resources may be used without revalidation for a while.
+#define HTTP_CACHE_REVALIDATE "no-cache"
+#define HTTP_CACHE_STATIC     "public, max-age=604800"
+
+// Quoted entity tag from a build time content hash, see add_web_asset() in CMakeLists.txt
+#define ETAG(hash) "\"" hash "\""
 
 typedef char fs_scratch_t[SCRATCH_BUFSIZE];
 typedef char fs_path_t[ESP_VFS_PATH_MAX + 1];
@@ -48,6 +57,12 @@ bool httpdaemon_start(network_settings_t *network);
 void httpdaemon_stop();
 esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename);
 char *http_get_key_value (char *qstring, char *key, char *s, size_t val_size);
+bool http_accepts_gzip (httpd_req_t *req);
+void http_path_cache_invalidate (void);
+uint32_t http_path_cache_generation (void);
+bool http_session_hold (void);
+void http_session_release (void);
+esp_err_t http_send_asset (httpd_req_t *req, const unsigned char *start, const unsigned char *end, const char *etag, const char *cache_control);
 
 #endif
 
@@ -0,0 +1,298 @@
+/*
+  deflate.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  On the fly gzip compression of http responses
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if WEBUI_ENABLE
+
+#include <string.h>
+
+#include "esp_rom_crc.h"
+
+#include "deflate.h"
+#include "backend.h"
+
+#define DEFLATE_BUFSIZE   (DEFLATE_WINDOW * 2)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+struct deflate {
+    httpd_req_t *req;
+    bool busy;
+    bool ok;
+    uint32_t crc;
+    uint32_t isize;
+    uint32_t bits;              // pending output bits, LSB first
+    uint_fast8_t nbits;
+    uint32_t base;              // stream position of buf[0]
+    size_t start;               // next byte to encode
+    size_t end;                 // end of data in buf
+    size_t out_length;
+    uint16_t head[1 << DEFLATE_HASH_BITS]; // low 16 bits of the stream position of the last occurence of a hash
+    uint8_t buf[DEFLATE_BUFSIZE];
+    uint8_t out[DEFLATE_OUTBUF_SIZE];
+};
+
+static const uint16_t length_base[] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073
+};
+static const uint8_t distance_extra[] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10
+};
+
+static struct deflate encoder = {0};
+
+static void flush_output (deflate_t *deflate)
+{
+    if(deflate->out_length) {
+        if(deflate->ok)
+            deflate->ok = httpd_resp_send_chunk(deflate->req, (const char *)deflate->out, deflate->out_length) == ESP_OK;
+        deflate->out_length = 0;
+    }
+}
+
+static inline void put_byte (deflate_t *deflate, uint8_t c)
+{
+    deflate->out[deflate->out_length++] = c;
+
+    if(deflate->out_length == DEFLATE_OUTBUF_SIZE)
+        flush_output(deflate);
+}
+
+static void put_bits (deflate_t *deflate, uint32_t value, uint_fast8_t count)
+{
+    deflate->bits |= value << deflate->nbits;
+    deflate->nbits += count;
+
+    while(deflate->nbits >= 8) {
+        put_byte(deflate, deflate->bits & 0xFF);
+        deflate->bits >>= 8;
+        deflate->nbits -= 8;
+    }
+}
+
+// Huffman codes are stored MSB first.
+static void put_code (deflate_t *deflate, uint32_t code, uint_fast8_t count)
+{
+    uint32_t reversed = 0;
+    uint_fast8_t i = count;
+
+    do {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    } while(--i);
+
+    put_bits(deflate, reversed, count);
+}
+
+// Fixed Huffman codes for the literal/length alphabet, RFC 1951 3.2.6
+static void put_symbol (deflate_t *deflate, uint_fast16_t symbol)
+{
+    if(symbol < 144)
+        put_code(deflate, 0x30 + symbol, 8);
+    else if(symbol < 256)
+        put_code(deflate, 0x190 + symbol - 144, 9);
+    else if(symbol < 280)
+        put_code(deflate, symbol - 256, 7);
+    else
+        put_code(deflate, 0xC0 + symbol - 280, 8);
+}
+
+static void put_match (deflate_t *deflate, uint_fast16_t length, uint_fast16_t distance)
+{
+    uint_fast8_t i = sizeof(length_base) / sizeof(length_base[0]);
+
+    while(length_base[--i] > length);
+
+    put_symbol(deflate, 257 + i);
+    if(length_extra[i])
+        put_bits(deflate, length - length_base[i], length_extra[i]);
+
+    i = sizeof(distance_base) / sizeof(distance_base[0]);
+
+    while(distance_base[--i] > distance);
+
+    put_code(deflate, i, 5);
+    if(distance_extra[i])
+        put_bits(deflate, distance - distance_base[i], distance_extra[i]);
+}
+
+static inline uint_fast16_t hash (const uint8_t *p)
+{
+    return (uint32_t)((p[0] | (p[1] << 8) | (p[2] << 16)) * 2654435761UL) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Encodes buffered data, keeps a full match length of lookahead unless final.
+static void encode (deflate_t *deflate, bool final)
+{
+    uint8_t *p, *q;
+    uint32_t pos;
+    uint_fast16_t h;
+    size_t avail, length, max_length, distance, i;
+
+    while(deflate->start < deflate->end && (final || deflate->end - deflate->start > DEFLATE_MAX_MATCH)) {
+
+        p = deflate->buf + deflate->start;
+        pos = deflate->base + deflate->start;
+        avail = deflate->end - deflate->start;
+        length = 0;
+
+        if(avail >= DEFLATE_MIN_MATCH) {
+            h = hash(p);
+            distance = (uint16_t)(pos - deflate->head[h]);
+            deflate->head[h] = (uint16_t)pos;
+            // The candidate may be stale, it is verified by comparing the data.
+            if(distance && distance <= DEFLATE_WINDOW && distance <= deflate->start) {
+                q = p - distance;
+                max_length = avail < DEFLATE_MAX_MATCH ? avail : DEFLATE_MAX_MATCH;
+                while(length < max_length && q[length] == p[length])
+                    length++;
+            }
+        }
+
+        if(length >= DEFLATE_MIN_MATCH) {
+            put_match(deflate, length, distance);
+            for(i = 1; i < length && i + DEFLATE_MIN_MATCH <= avail; i++)
+                deflate->head[hash(p + i)] = (uint16_t)(pos + i);
+            deflate->start += length;
+        } else {
+            put_symbol(deflate, *p);
+            deflate->start++;
+        }
+    }
+}
+
+// Returns the encoder if the client accepts gzip and the encoder is free, sets the response headers.
+deflate_t *deflate_begin (httpd_req_t *req)
+{
+    static const uint8_t header[] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+
+    if(encoder.busy || !http_accepts_gzip(req))
+        return NULL;
+
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    encoder.req = req;
+    encoder.busy = encoder.ok = true;
+    encoder.crc = encoder.isize = 0;
+    encoder.bits = encoder.nbits = 0;
+    encoder.base = encoder.start = encoder.end = 0;
+    encoder.out_length = 0;
+
+    memcpy(encoder.out, header, sizeof(header));
+    encoder.out_length = sizeof(header);
+
+    put_bits(&encoder, 0b010, 3); // not final, fixed Huffman codes
+
+    return &encoder;
+}
+
+bool deflate_write (deflate_t *deflate, const void *data, size_t length)
+{
+    size_t n, shift;
+
+    deflate->crc = esp_rom_crc32_le(deflate->crc, data, length);
+    deflate->isize += length;
+
+    while(length && deflate->ok) {
+
+        if(deflate->end == DEFLATE_BUFSIZE) { // keep a window of data before the next byte to encode
+            shift = deflate->start - DEFLATE_WINDOW;
+            memmove(deflate->buf, deflate->buf + shift, deflate->end - shift);
+            deflate->base += shift;
+            deflate->start -= shift;
+            deflate->end -= shift;
+        }
+
+        n = length < DEFLATE_BUFSIZE - deflate->end ? length : DEFLATE_BUFSIZE - deflate->end;
+        memcpy(deflate->buf + deflate->end, data, n);
+        deflate->end += n;
+        data = (const uint8_t *)data + n;
+        length -= n;
+
+        encode(deflate, false);
+    }
+
+    return deflate->ok;
+}
+
+// Encodes the remaining data, sends the gzip trailer and ends the chunked response. Releases the encoder.
+bool deflate_end (deflate_t *deflate)
+{
+    encode(deflate, true);
+
+    put_symbol(deflate, 256);       // end of block
+    put_bits(deflate, 0b011, 3);    // empty final block with fixed Huffman codes
+    put_symbol(deflate, 256);
+
+    if(deflate->nbits)
+        put_bits(deflate, 0, 8 - deflate->nbits);
+
+    put_bits(deflate, deflate->crc & 0xFFFF, 16);
+    put_bits(deflate, deflate->crc >> 16, 16);
+    put_bits(deflate, deflate->isize & 0xFFFF, 16);
+    put_bits(deflate, deflate->isize >> 16, 16);
+
+    flush_output(deflate);
+
+    if(deflate->ok)
+        deflate->ok = httpd_resp_send_chunk(deflate->req, NULL, 0) == ESP_OK;
+
+    deflate->busy = false;
+
+    return deflate->ok;
+}
+
+// Sends a block of a chunked response body, data == NULL ends the response. The body is compressed
+// if the first block is at least DEFLATE_MIN_SIZE bytes and the client accepts gzip.
+bool deflate_send_chunk (deflate_t **deflate, httpd_req_t *req, bool first, const void *data, size_t length)
+{
+    bool ok;
+
+    if(first && data && length >= DEFLATE_MIN_SIZE)
+        *deflate = deflate_begin(req);
+
+    if(*deflate == NULL)
+        return httpd_resp_send_chunk(req, data, data ? length : 0) == ESP_OK;
+
+    if(data)
+        return deflate_write(*deflate, data, length);
+
+    ok = deflate_end(*deflate);
+    *deflate = NULL;
+
+    return ok;
+}
+
+#endif
@@ -0,0 +1,53 @@
+/*
+  deflate.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  On the fly gzip compression of http responses
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Small footprint gzip encoder for dynamic responses (JSON documents, command output).
+  Uses a fixed Huffman block with greedy LZ77 matching against a 1K window and a single
+  candidate per hash, output is sent as response chunks. There is a single statically allocated
+  encoder, deflate_begin() returns NULL while it is in use or if the client does not accept gzip
+  and the response should then be sent uncompressed.
+*/
+
+#ifndef __DEFLATE_H__
+#define __DEFLATE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_http_server.h>
+
+#define DEFLATE_WINDOW      1024    // must be a power of 2
+#define DEFLATE_HASH_BITS   10
+#define DEFLATE_OUTBUF_SIZE 512
+#define DEFLATE_MIN_SIZE    512     // smaller responses are not worth compressing
+
+typedef struct deflate deflate_t;
+
+deflate_t *deflate_begin (httpd_req_t *req);
+bool deflate_write (deflate_t *deflate, const void *data, size_t length);
+bool deflate_end (deflate_t *deflate);
+bool deflate_send_chunk (deflate_t **deflate, httpd_req_t *req, bool first, const void *data, size_t length);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+  events.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Server-Sent Events stream of realtime reports
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if WEBUI_ENABLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/timers.h"
+
+#include "events.h"
+#include "backend.h"
+#include "grbl/report.h"
+#include "grbl/protocol.h"
+
+#define EVENTS_BUFSIZE 256
+
+typedef struct {
+    int fd;                 // -1 if slot is free
+    uint32_t session;       // id of the subscription holding the slot
+    uint16_t interval;      // in ticks
+    uint16_t countdown;
+    volatile bool due;
+} events_client_t;
+
+// Session context, identifies the subscription as the slot may be reused after it is released.
+typedef struct {
+    events_client_t *client;
+    uint32_t session;
+} events_session_t;
+
+static httpd_handle_t server = NULL;
+static TimerHandle_t timer = NULL;
+static volatile bool render_pending = false;
+static uint32_t sessions = 0;
+static events_client_t clients[EVENTS_MAX_CLIENTS] = {
+    { .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+
+// The report is captured without line terminators, the chunk is prefixed by its size
+// and contains the complete event: "event: status\ndata: <report>\n\n".
+static struct {
+    size_t length;
+    char data[EVENTS_BUFSIZE];
+} report, chunk;
+
+static void events_capture (const char *s)
+{
+    char c;
+
+    while((c = *s++) && report.length < sizeof(report.data) - 1) {
+        if(c != '\r' && c != '\n')
+            report.data[report.length++] = c;
+    }
+}
+
+static void events_release (events_client_t *client)
+{
+    int fd = client->fd;
+
+    client->fd = -1;
+    httpd_sess_trigger_close(server, fd);
+}
+
+// Called by the server when the session is closed, either by the client or after a failed send.
+// The slot is only freed if it still belongs to this session.
+static void events_session_closed (void *ctx)
+{
+    events_session_t *session = (events_session_t *)ctx;
+
+    if(session->client->session == session->session)
+        session->client->fd = -1;
+
+    free(session);
+    http_session_release();
+}
+
+// Runs in the server task, clients that cannot be written to are dropped.
+static void events_send (void *arg)
+{
+    uint_fast8_t idx = EVENTS_MAX_CLIENTS;
+
+    do {
+        events_client_t *client = &clients[--idx];
+        if(client->fd >= 0 && client->due) {
+            client->due = false;
+            if(httpd_socket_send(server, client->fd, chunk.data, chunk.length, 0) != chunk.length)
+                events_release(client);
+        }
+    } while(idx);
+
+    render_pending = false;
+}
+
+// Runs in the foreground (grbl) task, the only task writing to the stream. The core (HAL version 9) declares
+// void report_realtime_status (void), which writes to hal.stream, so the stream output is redirected to the
+// capture buffer while the report is rendered.
+static void events_render (sys_state_t state)
+{
+    stream_write_ptr write = hal.stream.write, write_all = hal.stream.write_all;
+
+    report.length = 0;
+    hal.stream.write = hal.stream.write_all = events_capture;
+    report_realtime_status();
+    hal.stream.write = write;
+    hal.stream.write_all = write_all;
+    report.data[report.length] = '\0';
+
+    int length = snprintf(chunk.data + 6, sizeof(chunk.data) - 8, "event: status\ndata: %s\n\n", report.data);
+
+    if(length > 0 && length < sizeof(chunk.data) - 8) {
+        char size[7];
+        sprintf(size, "%04X\r\n", length);
+        memcpy(chunk.data, size, 6);
+        memcpy(chunk.data + 6 + length, "\r\n", 2);
+        chunk.length = length + 8;
+        if(server && httpd_queue_work(server, events_send, NULL) == ESP_OK)
+            return;
+    }
+
+    render_pending = false;
+}
+
+static void events_tick (TimerHandle_t xTimer)
+{
+    bool due = false;
+    uint_fast8_t idx = EVENTS_MAX_CLIENTS;
+
+    do {
+        events_client_t *client = &clients[--idx];
+        if(client->fd >= 0 && --client->countdown == 0) {
+            client->countdown = client->interval;
+            client->due = due = true;
+        }
+    } while(idx);
+
+    if(due && !render_pending) {
+        render_pending = true;
+        protocol_enqueue_rt_command(events_render);
+    }
+}
+
+// Subscribes the client, the handler returns with the connection kept open and the response unfinished.
+esp_err_t events_get_handler (httpd_req_t *req)
+{
+    uint_fast8_t idx = EVENTS_MAX_CLIENTS;
+    int fd = httpd_req_to_sockfd(req);
+    events_client_t *client = NULL;
+
+    do {
+        if(clients[--idx].fd == fd || (client == NULL && clients[idx].fd < 0))
+            client = &clients[idx];
+    } while(idx);
+
+    if(client == NULL || !http_session_hold())
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Too many clients");
+
+    events_session_t *session;
+
+    if((session = malloc(sizeof(events_session_t))) == NULL) {
+        http_session_release();
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+    }
+
+    if(timer == NULL && (timer = xTimerCreate("events", pdMS_TO_TICKS(EVENTS_TICK), pdTRUE, NULL, events_tick)) == NULL) {
+        free(session);
+        http_session_release();
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to start events");
+    }
+
+    uint32_t interval = EVENTS_INTERVAL;
+    size_t qlen = httpd_req_get_url_query_len(req);
+
+    if(qlen) {
+        char query[32], value[8];
+        if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+            http_get_key_value(query, "interval", value, sizeof(value)))
+            interval = min(max(atoi(value), EVENTS_TICK * 2), EVENTS_INTERVAL_MAX);
+    }
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    // Sends the response headers, events are written to the socket from now on as chunks.
+    if(httpd_resp_send_chunk(req, "retry: 2000\n\n", HTTPD_RESP_USE_STRLEN) != ESP_OK) {
+        free(session);
+        http_session_release();
+        return ESP_FAIL;
+    }
+
+    // The slot is released via the session context when the connection is closed so
+    // events are never written to a socket number reused for a new connection.
+    session->client = client;
+    session->session = client->session = ++sessions;
+    req->sess_ctx = session;
+    req->free_ctx = events_session_closed;
+
+    server = req->handle;
+    client->interval = client->countdown = (interval + EVENTS_TICK / 2) / EVENTS_TICK;
+    client->due = false;
+    client->fd = fd;
+
+    xTimerStart(timer, 0);
+
+    return ESP_OK;
+}
+
+// Drops all clients, to be called before the server is stopped.
+void events_stop (void)
+{
+    uint_fast8_t idx = EVENTS_MAX_CLIENTS;
+
+    if(timer)
+        xTimerStop(timer, 0);
+
+    do {
+        clients[--idx].fd = -1;
+    } while(idx);
+
+    server = NULL;
+}
+
+#endif
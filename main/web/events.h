@@ -0,0 +1,46 @@
+/*
+  events.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Server-Sent Events stream of realtime reports
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  GET /events[?interval=<ms>] keeps the connection open and sends the realtime report as a
+  "status" event every interval ms (default EVENTS_INTERVAL). The report is rendered once per
+  tick and shared by all clients due in that tick.
+
+  Each client holds one of the session slots shared with the /ws console and download transfers,
+  see http_session_hold(), so not all EVENTS_MAX_CLIENTS may be available.
+*/
+
+#ifndef __EVENTS_H__
+#define __EVENTS_H__
+
+#include <esp_http_server.h>
+
+#define EVENTS_MAX_CLIENTS  4
+#define EVENTS_TICK         50      // ms, client intervals are rounded to a multiple of this
+#define EVENTS_INTERVAL     250     // ms
+#define EVENTS_INTERVAL_MAX 10000   // ms
+
+esp_err_t events_get_handler (httpd_req_t *req);
+void events_stop (void);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+  json_writer.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Streaming JSON writer with bounded memory use
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if WEBUI_ENABLE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "json_writer.h"
+
+static void json_flush (json_writer_t *json)
+{
+    if(json->length) {
+        json->buffer[json->length] = '\0';
+        if(json->ok)
+            json->ok = json->sink(json->ctx, json->buffer, json->length);
+        json->length = 0;
+    }
+}
+
+static inline void json_putc (json_writer_t *json, char c)
+{
+    if(json->length == JSON_WRITER_BUFSIZE)
+        json_flush(json);
+
+    json->buffer[json->length++] = c;
+}
+
+static void json_puts (json_writer_t *json, const char *s)
+{
+    while(*s)
+        json_putc(json, *s++);
+}
+
+static void json_put_string (json_writer_t *json, const char *s)
+{
+    char c, hex[7];
+
+    json_putc(json, '"');
+
+    while((c = *s++)) {
+        switch(c) {
+
+            case '"':
+            case '\\':
+                json_putc(json, '\\');
+                json_putc(json, c);
+                break;
+
+            case '\n':
+                json_puts(json, "\\n");
+                break;
+
+            case '\r':
+                json_puts(json, "\\r");
+                break;
+
+            case '\t':
+                json_puts(json, "\\t");
+                break;
+
+            default:
+                if((uint8_t)c < 0x20) {
+                    sprintf(hex, "\\u%04x", (uint8_t)c);
+                    json_puts(json, hex);
+                } else
+                    json_putc(json, c);
+                break;
+        }
+    }
+
+    json_putc(json, '"');
+}
+
+// Emit separator and key for a new member of the current object or array.
+static void json_member (json_writer_t *json, const char *key)
+{
+    uint32_t level = 1UL << json->depth;
+
+    if(json->empty & level)
+        json->empty &= ~level;
+    else
+        json_putc(json, ',');
+
+    if(key) {
+        json_put_string(json, key);
+        json_putc(json, ':');
+    }
+}
+
+static void json_open (json_writer_t *json, const char *key, char c)
+{
+    if(json->depth)
+        json_member(json, key);
+
+    json_putc(json, c);
+
+    if(json->depth < JSON_WRITER_MAX_DEPTH - 1)
+        json->empty |= 1UL << ++json->depth;
+    else
+        json->ok = false;
+}
+
+static void json_close (json_writer_t *json, char c)
+{
+    if(json->depth)
+        json->depth--;
+
+    json_putc(json, c);
+}
+
+// Documents larger than the buffer are compressed if the client accepts it.
+static bool json_http_sink (void *ctx, const char *data, size_t length)
+{
+    json_writer_t *json = (json_writer_t *)ctx;
+
+    return deflate_send_chunk(&json->deflate, json->req, json->flushes++ == 0, data, length);
+}
+
+void json_writer_init (json_writer_t *json, json_sink_ptr sink, void *ctx)
+{
+    json->sink = sink;
+    json->ctx = ctx;
+    json->ok = true;
+    json->depth = 0;
+    json->empty = 0;
+    json->length = 0;
+    json->flushes = 0;
+    json->req = NULL;
+    json->deflate = NULL;
+}
+
+// Send as the body of a chunked HTTP response
+void json_writer_init_http (json_writer_t *json, httpd_req_t *req)
+{
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    json_writer_init(json, json_http_sink, json);
+    json->req = req;
+}
+
+// Flushes the remaining output and signals the end of the document to the sink.
+bool json_writer_end (json_writer_t *json)
+{
+    json_flush(json);
+
+    if(json->ok)
+        json->ok = json->sink(json->ctx, NULL, 0);
+    else if(json->deflate)
+        deflate_end(json->deflate); // release the encoder
+
+    return json->ok;
+}
+
+// Abandons the document, buffered output is discarded and the sink is not told that the document is complete.
+void json_writer_abort (json_writer_t *json)
+{
+    json->ok = false;
+    json_writer_end(json);
+}
+
+// Returns true if output has been passed to the sink, for a HTTP response the status line has then been sent.
+bool json_writer_started (json_writer_t *json)
+{
+    return json->flushes != 0;
+}
+
+void json_start_object (json_writer_t *json, const char *key)
+{
+    json_open(json, key, '{');
+}
+
+void json_end_object (json_writer_t *json)
+{
+    json_close(json, '}');
+}
+
+void json_start_array (json_writer_t *json, const char *key)
+{
+    json_open(json, key, '[');
+}
+
+void json_end_array (json_writer_t *json)
+{
+    json_close(json, ']');
+}
+
+void json_add_string (json_writer_t *json, const char *key, const char *value)
+{
+    json_member(json, key);
+
+    if(value)
+        json_put_string(json, value);
+    else
+        json_puts(json, "null");
+}
+
+void json_add_int (json_writer_t *json, const char *key, int32_t value)
+{
+    char num[12];
+
+    json_member(json, key);
+    sprintf(num, "%d", value);
+    json_puts(json, num);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+  json_writer.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Streaming JSON writer with bounded memory use
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_http_server.h>
+
+#include "deflate.h"
+
+#define JSON_WRITER_BUFSIZE 512
+#define JSON_WRITER_MAX_DEPTH 32
+
+// Output is passed to the sink when the buffer is full, data is NUL terminated at length.
+// The sink is called with data == NULL when the document is complete.
+typedef bool (*json_sink_ptr)(void *ctx, const char *data, size_t length);
+
+typedef struct {
+    json_sink_ptr sink;
+    void *ctx;
+    bool ok;
+    uint8_t depth;
+    uint32_t empty;         // bit per nesting level, set until the first member is written
+    size_t length;
+    uint32_t flushes;
+    httpd_req_t *req;       // set when sending as the body of a HTTP response
+    deflate_t *deflate;     // set when the response is compressed
+    char buffer[JSON_WRITER_BUFSIZE + 1];
+} json_writer_t;
+
+void json_writer_init (json_writer_t *json, json_sink_ptr sink, void *ctx);
+void json_writer_init_http (json_writer_t *json, httpd_req_t *req);
+bool json_writer_end (json_writer_t *json);
+void json_writer_abort (json_writer_t *json);
+bool json_writer_started (json_writer_t *json);
+
+// key is NULL for array elements, a NULL string value is written as null
+void json_start_object (json_writer_t *json, const char *key);
+void json_end_object (json_writer_t *json);
+void json_start_array (json_writer_t *json, const char *key);
+void json_end_array (json_writer_t *json);
+void json_add_string (json_writer_t *json, const char *key, const char *value);
+void json_add_int (json_writer_t *json, const char *key, int32_t value);
+
+#endif
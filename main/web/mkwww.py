@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+#
+# mkwww.py - creates an image for the read-only "www" web asset partition, see wwwfs.h for the layout.
+#
+# Part of grblHAL
+#
+# Files with a .gz suffix are stored under their name without the suffix and flagged as gzip compressed,
+# others are compressed when that saves space. Flash the image with:
+#
+#   parttool.py write_partition --partition-name=www --input=www.bin
+#
+# Usage: mkwww.py <directory> <image> [partition size]
+
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = 0x31575757
+NAME_LENGTH = 56
+ENTRY_SIZE = NAME_LENGTH + 16
+FLAG_GZIP = 1
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("Usage: mkwww.py <directory> <image> [partition size]")
+
+    root, image = sys.argv[1], sys.argv[2]
+    size = int(sys.argv[3], 0) if len(sys.argv) > 3 else 0x80000
+    files = {}
+
+    for dirpath, _, filenames in os.walk(root):
+        for filename in filenames:
+            path = os.path.join(dirpath, filename)
+            name = '/' + os.path.relpath(path, root).replace(os.sep, '/')
+            with open(path, 'rb') as f:
+                data = f.read()
+            if name.endswith('.gz'):
+                files[name[:-3]] = (data, FLAG_GZIP)
+            elif name not in files:
+                packed = gzip.compress(data, 9, mtime=0)
+                files[name] = (packed, FLAG_GZIP) if len(packed) < len(data) else (data, 0)
+
+    offset = 8 + len(files) * ENTRY_SIZE
+    header = struct.pack('<II', MAGIC, len(files))
+    entries = b''
+    content = b''
+
+    for name in sorted(files):
+        data, flags = files[name]
+        if len(name.encode()) >= NAME_LENGTH:
+            sys.exit("Name too long: " + name)
+        entries += struct.pack('<%dsIIII' % NAME_LENGTH, name.encode(), offset + len(content), len(data), zlib.crc32(data), flags)
+        content += data
+
+    blob = header + entries + content
+    if len(blob) > size:
+        sys.exit("Image size %d exceeds partition size %d" % (len(blob), size))
+
+    with open(image, 'wb') as f:
+        f.write(blob)
+
+    print("%d files, %d bytes" % (len(files), len(blob)))
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,227 @@
+/*
+  transfer.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Worker tasks for sending large files
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if WEBUI_ENABLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/task.h"
+
+#include "transfer.h"
+#include "backend.h"
+#include "grbl/nuts_bolts.h"
+
+#define TRANSFER_CHUNK_HDR 6    // "XXXX\r\n", TRANSFER_BLOCK_SIZE must fit in four hex digits
+
+typedef struct {
+    TaskHandle_t task;
+    httpd_handle_t server;
+    int fd;
+    volatile bool active;   // set while the worker is sending
+    volatile bool open;     // set until the server has closed the session
+    volatile bool sent;     // result of the last send, set by the server task
+    bool last;              // close the session after the pending data is sent
+    size_t pending;         // number of bytes in buf to send
+    size_t length;          // remaining number of bytes to read
+    void *handle;
+    transfer_read_ptr read;
+    transfer_close_ptr close;
+    char *buf;
+} transfer_t;
+
+static volatile bool stopping = false;
+static transfer_t workers[TRANSFER_WORKERS] = {0};
+
+// Called by the server when the session is closed, the slot is free for reuse when the worker is done.
+static void transfer_session_closed (void *ctx)
+{
+    ((transfer_t *)ctx)->open = false;
+    http_session_release();
+}
+
+// Runs in the server task. The socket is only written to while it still belongs to the session
+// of the transfer, the server may have closed it and reused the number for a new connection.
+static void transfer_send (void *arg)
+{
+    int sent;
+    transfer_t *transfer = (transfer_t *)arg;
+    const char *data = transfer->buf;
+    size_t length = transfer->pending;
+
+    if((transfer->sent = transfer->open && httpd_sess_get_ctx(transfer->server, transfer->fd) == transfer)) {
+
+        while(length && (sent = httpd_socket_send(transfer->server, transfer->fd, data, length, 0)) > 0) {
+            data += sent;
+            length -= sent;
+        }
+
+        transfer->sent = length == 0;
+
+        if(transfer->last || !transfer->sent)
+            httpd_sess_trigger_close(transfer->server, transfer->fd);
+    }
+
+    xTaskNotifyGive(transfer->task);
+}
+
+// Hands the buffer over to the server task and waits until it is sent.
+static bool transfer_queue (transfer_t *transfer, size_t length, bool last)
+{
+    transfer->pending = length;
+    transfer->last = last;
+
+    if(stopping || httpd_queue_work(transfer->server, transfer_send, transfer) != ESP_OK)
+        return false;
+
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    return transfer->sent;
+}
+
+// Reads the file in the worker task, the server task only has to send the data.
+static void transfer_worker (void *arg)
+{
+    bool ok;
+    size_t length;
+    char size[TRANSFER_CHUNK_HDR + 1];
+    transfer_t *transfer = (transfer_t *)arg;
+
+    while(true) {
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        ok = true;
+
+        while(ok && transfer->length) {
+            if((ok = (length = transfer->read(transfer->handle, transfer->buf + TRANSFER_CHUNK_HDR, min(transfer->length, TRANSFER_BLOCK_SIZE))) > 0)) {
+                transfer->length -= length;
+                sprintf(size, "%04X\r\n", (unsigned int)length);
+                memcpy(transfer->buf, size, TRANSFER_CHUNK_HDR);
+                memcpy(transfer->buf + TRANSFER_CHUNK_HDR + length, "\r\n", 2);
+                ok = transfer_queue(transfer, length + TRANSFER_CHUNK_HDR + 2, false);
+            }
+        }
+
+        // A response without the terminating chunk tells the client the transfer failed.
+        if(ok)
+            memcpy(transfer->buf, "0\r\n\r\n", 5);
+
+        transfer_queue(transfer, ok ? 5 : 0, true);
+
+        transfer->close(transfer->handle);
+        transfer->active = false;
+    }
+}
+
+static transfer_t *get_worker (void)
+{
+    uint_fast8_t idx = TRANSFER_WORKERS;
+    transfer_t *transfer;
+
+    do {
+        transfer = &workers[--idx];
+        if(!(transfer->active || transfer->open)) {
+            if(transfer->buf == NULL && (transfer->buf = malloc(TRANSFER_BLOCK_SIZE + TRANSFER_CHUNK_HDR + 2)) == NULL)
+                return NULL;
+            if(transfer->task == NULL && xTaskCreate(transfer_worker, "transfer", 3072, transfer, tskIDLE_PRIORITY + 5, &transfer->task) != pdPASS) {
+                transfer->task = NULL;
+                return NULL;
+            }
+            return transfer;
+        }
+    } while(idx);
+
+    return NULL;
+}
+
+// Sends the response headers and the first block, then hands the rest over to a worker task.
+// Returns ESP_ERR_NOT_FOUND if no worker is available, the caller should then send the file itself.
+// Otherwise the handle is closed by the transfer.
+esp_err_t transfer_start (httpd_req_t *req, size_t length, void *handle, transfer_read_ptr read, transfer_close_ptr close)
+{
+    size_t size;
+    transfer_t *transfer;
+
+    if(stopping || (transfer = get_worker()) == NULL || !http_session_hold())
+        return ESP_ERR_NOT_FOUND;
+
+    if((size = read(handle, transfer->buf, min(length, TRANSFER_BLOCK_SIZE))) == 0) {
+        close(handle);
+        http_session_release();
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read file");
+    }
+
+    // The connection is closed after the transfer so the server will not read
+    // a new request from it while the transfer is in progress.
+    httpd_resp_set_hdr(req, "Connection", "close");
+
+    // The headers may have been sent, the server closes the session on ESP_FAIL
+    // and the client sees an incomplete response.
+    if(httpd_resp_send_chunk(req, transfer->buf, size) != ESP_OK) {
+        close(handle);
+        http_session_release();
+        return ESP_FAIL;
+    }
+
+    req->sess_ctx = transfer;
+    req->free_ctx = transfer_session_closed;
+
+    transfer->server = req->handle;
+    transfer->fd = httpd_req_to_sockfd(req);
+    transfer->length = length - size;
+    transfer->handle = handle;
+    transfer->read = read;
+    transfer->close = close;
+    transfer->open = transfer->active = true;
+
+    xTaskNotifyGive(transfer->task);
+
+    return ESP_OK;
+}
+
+// Aborts running transfers, to be called before the server is stopped.
+void transfer_stop (void)
+{
+    uint_fast8_t idx, retries = 100;
+    bool active;
+
+    stopping = true;
+
+    do {
+        active = false;
+        idx = TRANSFER_WORKERS;
+        do {
+            active |= workers[--idx].active;
+        } while(idx);
+        if(active)
+            vTaskDelay(pdMS_TO_TICKS(10));
+    } while(active && --retries);
+
+    stopping = false;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+  transfer.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Worker tasks for sending large files
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Large file downloads are handed off to a small pool of worker tasks so that the http server
+  task is free to handle control and status requests meanwhile. The handler sends the response
+  headers and the first block, the worker reads the rest and queues each block as a chunk to be
+  sent by the server task, which closes the connection when done. If all workers are busy or
+  no session slot is free (see http_session_hold()) the handler sends the file itself.
+*/
+
+#ifndef __TRANSFER_H__
+#define __TRANSFER_H__
+
+#include <esp_http_server.h>
+
+#define TRANSFER_WORKERS    2
+#define TRANSFER_BLOCK_SIZE 4096
+#define TRANSFER_MIN_SIZE   (32 * 1024) // smaller files are sent by the handler
+
+// Returns the number of bytes read, 0 on end of file or error.
+typedef size_t (*transfer_read_ptr)(void *handle, char *buf, size_t size);
+typedef void (*transfer_close_ptr)(void *handle);
+
+esp_err_t transfer_start (httpd_req_t *req, size_t length, void *handle, transfer_read_ptr read, transfer_close_ptr close);
+void transfer_stop (void);
+
+#endif
@@ -0,0 +1,412 @@
+/*
+  wsstream.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  WebSocket stream on the http server
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if WEBUI_ENABLE && CONFIG_HTTPD_WS_SUPPORT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/timers.h"
+
+#include "wsstream.h"
+#include "backend.h"
+#include "grbl/hal.h"
+#include "grbl/protocol.h"
+#include "grbl/state_machine.h"
+#include "grbl/system.h"
+#include "grbl/gcode.h"
+#include "grbl/stepper.h"
+#include "grbl/nuts_bolts.h"
+
+#define WS_TX_CHUNK 512 // max payload of console frames
+
+typedef struct {
+    uint8_t type;
+    uint8_t version;
+    uint16_t state;
+    uint8_t n_axis;
+    uint8_t feed_override;
+    uint8_t rapid_override;
+    uint8_t spindle_override;
+    float position[N_AXIS];
+    float wco[N_AXIS];
+    float feed_rate;
+    float spindle_rpm;
+} __attribute__((packed)) ws_status_t;
+
+static struct {
+    httpd_handle_t server;
+    volatile int fd;                // -1 if no client is connected
+    uint16_t interval;              // in ticks, 0 if status frames are disabled
+    uint16_t countdown;
+    volatile bool send_pending;     // console output queued for sending by the server task
+    volatile bool status_pending;   // status frame being rendered or sent
+    volatile bool connected;        // stream is connected, only changed by the foreground process
+} client = { .fd = -1 };
+
+static TimerHandle_t timer = NULL;
+static ws_status_t status;
+static stream_rx_buffer_t rxbuffer = {0}, rxbackup;
+static uint8_t rxframe[WS_RX_FRAME_MAX];
+static enqueue_realtime_command_ptr enqueue_realtime_command = protocol_enqueue_realtime_command;
+
+// Console output, lines are added by the foreground process and sent by the server task.
+static struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint_fast16_t line;     // start of the line being added
+    char data[WS_TX_BUFFER_SIZE];
+} txbuffer = {0};
+
+static void ws_session_closed (void *ctx);
+
+static enqueue_realtime_command_ptr wsSetRtHandler (enqueue_realtime_command_ptr handler)
+{
+    enqueue_realtime_command_ptr prev = enqueue_realtime_command;
+
+    if(handler)
+        enqueue_realtime_command = handler;
+
+    return prev;
+}
+
+static uint16_t wsStreamRXFree (void)
+{
+    uint16_t head = rxbuffer.head, tail = rxbuffer.tail;
+
+    return (RX_BUFFER_SIZE - 1) - BUFCOUNT(head, tail, RX_BUFFER_SIZE);
+}
+
+static int16_t wsStreamGetNull (void)
+{
+    return -1;
+}
+
+static int16_t wsStreamGetC (void)
+{
+    int16_t data;
+    uint_fast16_t bptr = rxbuffer.tail;
+
+    if(bptr == BUFFER_LOAD(rxbuffer.head))
+        return -1; // no data available else EOF
+
+    data = rxbuffer.data[bptr++];                               // Get next character, increment tmp pointer
+    BUFFER_STORE(rxbuffer.tail, bptr & (RX_BUFFER_SIZE - 1));   // and update pointer
+
+    return data;
+}
+
+static void wsStreamFlush (void)
+{
+    rxbuffer.tail = rxbuffer.head;
+}
+
+static void wsStreamCancel (void)
+{
+    rxbuffer.data[rxbuffer.head] = ASCII_CAN;
+    rxbuffer.tail = rxbuffer.head;
+    rxbuffer.head = (rxbuffer.tail + 1) & (RX_BUFFER_SIZE - 1);
+}
+
+static bool wsStreamSuspendInput (bool suspend)
+{
+    if(suspend)
+        hal.stream.read = wsStreamGetNull;
+    else if(rxbuffer.backup)
+        memcpy(&rxbuffer, &rxbackup, sizeof(stream_rx_buffer_t));
+
+    return rxbuffer.tail != rxbuffer.head;
+}
+
+// Runs in the server task, sends complete lines as text frames.
+static void ws_send_console (void *arg)
+{
+    uint32_t head, tail, length;
+    httpd_ws_frame_t frame = { .type = HTTPD_WS_TYPE_TEXT };
+
+    do {
+        client.send_pending = false;
+        head = __atomic_load_n(&txbuffer.head, __ATOMIC_ACQUIRE);
+        while((tail = txbuffer.tail) != head) {
+            length = min(min(head - tail, WS_TX_CHUNK), WS_TX_BUFFER_SIZE - (tail & (WS_TX_BUFFER_SIZE - 1)));
+            frame.payload = (uint8_t *)&txbuffer.data[tail & (WS_TX_BUFFER_SIZE - 1)];
+            frame.len = length;
+            if(client.fd >= 0 && httpd_ws_send_frame_async(client.server, client.fd, &frame) != ESP_OK)
+                httpd_sess_trigger_close(client.server, client.fd);
+            __atomic_store_n(&txbuffer.tail, tail + length, __ATOMIC_RELEASE);
+        }
+    } while(head != __atomic_load_n(&txbuffer.head, __ATOMIC_ACQUIRE) && !client.send_pending);
+}
+
+// Queues sending of buffered output unless already pending, retried on the next call if queueing fails.
+static void ws_queue_send (void)
+{
+    if(!client.send_pending && client.fd >= 0) {
+        client.send_pending = true;
+        if(httpd_queue_work(client.server, ws_send_console, NULL) != ESP_OK)
+            client.send_pending = false;
+    }
+}
+
+// Output is buffered until a line is complete, sends what is buffered and waits
+// for the server task to free space when the buffer is full.
+// Single producer, only to be called from the foreground process. Must never be called from the
+// server task as it would wait forever for ws_send_console() when the buffer is full.
+static bool wsStreamPutC (const char c)
+{
+    uint32_t head = txbuffer.head;
+
+    while(head - __atomic_load_n(&txbuffer.tail, __ATOMIC_ACQUIRE) >= WS_TX_BUFFER_SIZE) {
+        if(client.fd < 0)
+            return false;
+        ws_queue_send();
+        vTaskDelay(1);
+    }
+
+    txbuffer.data[head & (WS_TX_BUFFER_SIZE - 1)] = c;
+    __atomic_store_n(&txbuffer.head, ++head, __ATOMIC_RELEASE);
+
+    if(c == ASCII_LF)
+        ws_queue_send();
+
+    return true;
+}
+
+static void wsStreamWriteS (const char *data)
+{
+    char c, *ptr = (char *)data;
+
+    while((c = *ptr++) != '\0')
+        wsStreamPutC(c);
+}
+
+static const io_stream_t ws_stream = {
+    .type = StreamType_WebSocket,
+    .state.connected = true,
+    .read = wsStreamGetC,
+    .write = wsStreamWriteS,
+    .write_char = wsStreamPutC,
+    .get_rx_buffer_free = wsStreamRXFree,
+    .reset_read_buffer = wsStreamFlush,
+    .cancel_read_buffer = wsStreamCancel,
+    .suspend_read = wsStreamSuspendInput,
+    .set_enqueue_rt_handler = wsSetRtHandler
+};
+
+static void ws_rx_data (const uint8_t *data, size_t length)
+{
+    char c;
+
+    while(length--) {
+        c = (char)*data++;
+        // discard input if MPG has taken over...
+        if(hal.stream.type != StreamType_MPG) {
+            if(c == CMD_TOOL_ACK && !rxbuffer.backup) {
+
+                memcpy(&rxbackup, &rxbuffer, sizeof(stream_rx_buffer_t));
+                rxbuffer.backup = true;
+                rxbuffer.tail = rxbuffer.head;
+                hal.stream.read = wsStreamGetC; // restore normal input
+
+            } else if(!enqueue_realtime_command(c)) {
+
+                uint_fast16_t bptr = (rxbuffer.head + 1) & (RX_BUFFER_SIZE - 1);  // Get next head pointer
+
+                if(bptr == BUFFER_LOAD(rxbuffer.tail))  // If buffer full
+                    rxbuffer.overflow = 1;              // flag overflow,
+                else {
+                    rxbuffer.data[rxbuffer.head] = c;   // else add data to buffer
+                    BUFFER_STORE(rxbuffer.head, bptr);  // and update pointer
+                }
+            }
+        }
+    }
+}
+
+// Runs in the server task.
+static void ws_send_status (void *arg)
+{
+    httpd_ws_frame_t frame = {
+        .type = HTTPD_WS_TYPE_BINARY,
+        .payload = (uint8_t *)&status,
+        .len = sizeof(ws_status_t)
+    };
+
+    if(client.fd >= 0 && httpd_ws_send_frame_async(client.server, client.fd, &frame) != ESP_OK)
+        httpd_sess_trigger_close(client.server, client.fd);
+
+    client.status_pending = false;
+}
+
+// Runs in the foreground (grbl) task.
+static void ws_render_status (sys_state_t state)
+{
+    uint_fast8_t idx;
+
+    status.type = 'S';
+    status.version = WS_STATUS_VERSION;
+    status.state = (uint16_t)state_get();
+    status.n_axis = N_AXIS;
+    status.feed_override = sys.override.feed_rate;
+    status.rapid_override = sys.override.rapid_rate;
+    status.spindle_override = sys.override.spindle_rpm;
+    system_convert_array_steps_to_mpos(status.position, sys.position);
+    for(idx = 0; idx < N_AXIS; idx++)
+        status.wco[idx] = gc_state.coord_system.xyz[idx] + gc_state.g92_coord_offset[idx] + gc_state.tool_length_offset[idx];
+    status.feed_rate = st_get_realtime_rate();
+    status.spindle_rpm = sys.spindle_rpm;
+
+    if(client.fd < 0 || httpd_queue_work(client.server, ws_send_status, NULL) != ESP_OK)
+        client.status_pending = false;
+}
+
+static void ws_tick (TimerHandle_t xTimer)
+{
+    if(client.fd >= 0 && client.interval && --client.countdown == 0) {
+        client.countdown = client.interval;
+        if(!client.status_pending) {
+            client.status_pending = true;
+            protocol_enqueue_rt_command(ws_render_status);
+        }
+    }
+}
+
+// Runs in the foreground, the stream is (re)connected and announced to the client unless it has already gone.
+static void ws_stream_connect (sys_state_t state)
+{
+    if(client.fd >= 0) {
+        if(!client.connected) {
+            client.connected = true;
+            stream_connect(&ws_stream);
+        }
+        hal.stream.write_all("[MSG:WS OK]" ASCII_EOL);
+    }
+}
+
+// Runs in the foreground, the stream is left connected if a new client has connected meanwhile.
+static void ws_stream_disconnect (sys_state_t state)
+{
+    if(client.fd < 0 && client.connected) {
+        client.connected = false;
+        stream_disconnect(&ws_stream);
+    }
+}
+
+static bool ws_connect (httpd_req_t *req)
+{
+    uint32_t interval = WS_STATUS_INTERVAL;
+    size_t qlen = httpd_req_get_url_query_len(req);
+
+    if(qlen) {
+        char query[32], value[8];
+        if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+            http_get_key_value(query, "status", value, sizeof(value)))
+            interval = atoi(value) ? min(max(atoi(value), WS_STATUS_TICK * 2), WS_STATUS_MAX) : 0;
+    }
+
+    if(timer == NULL && (timer = xTimerCreate("wsstatus", pdMS_TO_TICKS(WS_STATUS_TICK), pdTRUE, NULL, ws_tick)) == NULL)
+        return false;
+
+    if(req->sess_ctx != &client && !http_session_hold())
+        return false;
+
+    // The stream is disconnected via the session context when the connection is closed.
+    req->sess_ctx = &client;
+    req->free_ctx = ws_session_closed;
+
+    // The buffers are not in use by the foreground process until the stream is connected.
+    // If the previous client has not been disconnected yet they are handed over as they are.
+    if(!client.connected) {
+        rxbuffer.head = rxbuffer.tail = 0;
+        rxbuffer.backup = false;
+        txbuffer.head = txbuffer.tail = 0;
+    }
+
+    client.server = req->handle;
+    client.interval = client.countdown = (interval + WS_STATUS_TICK / 2) / WS_STATUS_TICK;
+    client.send_pending = client.status_pending = false;
+    client.fd = httpd_req_to_sockfd(req);
+
+    // hal.stream belongs to the foreground process, it is connected from there.
+    if(!protocol_enqueue_rt_command(ws_stream_connect)) {
+        client.fd = -1;
+        return false;
+    }
+
+    if(client.interval)
+        xTimerStart(timer, 0);
+
+    return true;
+}
+
+// Called by the server when the session is closed, either by the client or after a failed send.
+static void ws_session_closed (void *ctx)
+{
+    if(ctx)
+        http_session_release();
+
+    if(client.fd >= 0) {
+        client.fd = -1;
+        if(timer)
+            xTimerStop(timer, 0);
+        protocol_enqueue_rt_command(ws_stream_disconnect);
+    }
+}
+
+// Called on the handshake and then for every data frame received, control frames are handled by the server.
+esp_err_t wsstream_handler (httpd_req_t *req)
+{
+    if(req->method == HTTP_GET) {
+        // Only one client at a time
+        if(client.fd >= 0 && client.fd != httpd_req_to_sockfd(req))
+            return ESP_FAIL;
+        return ws_connect(req) ? ESP_OK : ESP_FAIL;
+    }
+
+    httpd_ws_frame_t frame = { .payload = rxframe };
+
+    if(httpd_ws_recv_frame(req, &frame, 0) != ESP_OK)
+        return ESP_FAIL;
+
+    if(frame.len > sizeof(rxframe))
+        return ESP_FAIL; // drops the connection as the rest of the frame cannot be skipped
+
+    if(frame.len && httpd_ws_recv_frame(req, &frame, frame.len) != ESP_OK)
+        return ESP_FAIL;
+
+    if(httpd_req_to_sockfd(req) == client.fd && (frame.type == HTTPD_WS_TYPE_TEXT || frame.type == HTTPD_WS_TYPE_BINARY))
+        ws_rx_data(frame.payload, frame.len);
+
+    return ESP_OK;
+}
+
+// Disconnects the client, to be called before the server is stopped.
+void wsstream_stop (void)
+{
+    ws_session_closed(NULL);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+  wsstream.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  WebSocket stream on the http server
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  GET /ws[?status=<ms>] upgrades to a WebSocket carrying the console stream, replaces the websocket daemon
+  on its own port for clients that use it.
+
+  Client -> controller: text or binary frames, payload is handled as input from a serial port
+  (realtime commands are acted upon immediately, the rest is added to the input buffer).
+
+  Controller -> client: text frames with console output, complete lines only.
+  Binary frames with the status every status ms (default WS_STATUS_INTERVAL, 0 to disable),
+  multi byte values are little endian:
+
+    offset  size
+      0       1     'S'
+      1       1     version, WS_STATUS_VERSION
+      2       2     state, see sys_state_t
+      4       1     number of axes (n)
+      5       1     feed override, %
+      6       1     rapid override, %
+      7       1     spindle override, %
+      8      4*n    machine position, float
+    8+4n     4*n    work coordinate offset, float
+    8+8n      4     current feed rate, float
+    12+8n     4     spindle RPM, float
+
+  Only one client can be connected at a time.
+*/
+
+#ifndef __WSSTREAM_H__
+#define __WSSTREAM_H__
+
+#include <esp_http_server.h>
+
+#define WS_STATUS_VERSION   1
+#define WS_STATUS_TICK      50      // ms, status intervals are rounded to a multiple of this
+#define WS_STATUS_INTERVAL  250     // ms
+#define WS_STATUS_MAX       10000   // ms
+#define WS_TX_BUFFER_SIZE   2048    // must be a power of 2
+#define WS_RX_FRAME_MAX     1024    // larger frames from the client are dropped
+
+esp_err_t wsstream_handler (httpd_req_t *req);
+void wsstream_stop (void);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+  wwwfs.c - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Read-only web asset partition, served directly from memory mapped flash
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "driver.h"
+
+#if WEBUI_ENABLE
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include "wwwfs.h"
+
+static const char *TAG = "wwwfs";
+
+static const wwwfs_header_t *www = NULL;
+static spi_flash_mmap_handle_t mmap_handle;
+
+// Maps the partition into the data address space, the mapping is kept for the lifetime of the application.
+bool wwwfs_mount (void)
+{
+    if(www)
+        return true;
+
+    const void *mapped;
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, WWWFS_SUBTYPE, "www");
+
+    if(partition == NULL)
+        return false;
+
+    if(esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &mmap_handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition");
+        return false;
+    }
+
+    const wwwfs_header_t *header = (const wwwfs_header_t *)mapped;
+    bool ok = header->magic == WWWFS_MAGIC &&
+               sizeof(wwwfs_header_t) + header->n_entries * sizeof(wwwfs_entry_t) <= partition->size;
+
+    if(ok) {
+        uint_fast16_t idx = header->n_entries;
+        while(ok && idx) {
+            const wwwfs_entry_t *entry = &header->entry[--idx];
+            ok = entry->offset <= partition->size && entry->length <= partition->size - entry->offset &&
+                  memchr(entry->name, '\0', WWWFS_NAME_LENGTH) != NULL;
+        }
+    }
+
+    if(ok)
+        www = header;
+    else {
+        ESP_LOGW(TAG, "No valid image in partition");
+        spi_flash_munmap(mmap_handle);
+    }
+
+    return ok;
+}
+
+bool wwwfs_find (const char *path, wwwfs_file_t *file)
+{
+    if(www) {
+
+        const wwwfs_entry_t *entry = www->entry;
+        uint_fast16_t idx = www->n_entries;
+
+        while(idx--) {
+            if(!strcmp(entry->name, path)) {
+                file->data = (const char *)www + entry->offset;
+                file->length = entry->length;
+                file->crc32 = entry->crc32;
+                file->gzipped = !!(entry->flags & WWWFS_FLAG_GZIP);
+                return true;
+            }
+            entry++;
+        }
+    }
+
+    return false;
+}
+
+#endif
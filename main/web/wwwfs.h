@@ -0,0 +1,70 @@
+/*
+  wwwfs.h - An embedded CNC Controller with rs274/ngc (g-code) support
+
+  Read-only web asset partition, served directly from memory mapped flash
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Partition image layout, all values are little endian and offsets are from the start of the partition:
+
+    header:  uint32 magic ("WWW1"), uint32 number of entries
+    entries: char name[56] (absolute path, NUL padded), uint32 offset, uint32 length, uint32 crc32, uint32 flags
+    data:    file contents
+
+  Flag bit 0 is set when the content is gzip compressed. The image is created by web/mkwww.py and
+  flashed to the "www" partition (data, subtype 0x40), e.g. with parttool.py.
+*/
+
+#ifndef __WWWFS_H__
+#define __WWWFS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WWWFS_MAGIC         0x31575757 // "WWW1"
+#define WWWFS_SUBTYPE       0x40
+#define WWWFS_NAME_LENGTH   56
+#define WWWFS_FLAG_GZIP     (1 << 0)
+
+typedef struct {
+    char name[WWWFS_NAME_LENGTH];
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc32;
+    uint32_t flags;
+} wwwfs_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t n_entries;
+    wwwfs_entry_t entry[];
+} wwwfs_header_t;
+
+typedef struct {
+    const char *data;
+    uint32_t length;
+    uint32_t crc32;
+    bool gzipped;
+} wwwfs_file_t;
+
+bool wwwfs_mount (void);
+bool wwwfs_find (const char *path, wwwfs_file_t *file);
+
+#endif
@@ -44,6 +44,8 @@
 #include "grbl/report.h"
 #include "wifi.h"
 #include "webui.h"
+#include "web/backend.h"
+#include "web/json_writer.h"
 #include "networking/websocketd.h"
 #include "networking/urldecode.h"
 #include "networking/utils.h"
@@ -91,6 +93,9 @@ typedef enum {
     //WebUICmd_SendMessage = 600,
     //WebUICmd_GetSetNotifications = 600,
     WebUICmd_ReadLocalFile = 700,
+    WebUICmd_IndexLocalFile = 701,
+    WebUICmd_QueueLocalFile = 702,
+    WebUICmd_GetClearJobQueue = 703,
     WebUICmd_FormatFlashFS = 710,
     WebUICmd_GetFlashFSCapacity = 720,
     WebUICmd_GetFirmwareSpec = 800
@@ -170,123 +175,105 @@ static char *get_arg (char *args, char *arg, bool spacedelimited)
     return value;
 }
 
-// add file to the JSON response array
-static bool add_setting (cJSON *settings, setting_id_t p, char t, int32_t bit, char *v, char *h, char *s, char *m)
+// add setting to the JSON response array
+static bool add_setting (json_writer_t *json, setting_id_t p, char t, int32_t bit, char *v, char *h, char *s, char *m)
 {
-    bool ok = true;
+    char ps[10], ts[2];
 
-    cJSON *setting;
+    itoa(p, ps, 10);
 
-    if((ok = (setting = cJSON_CreateObject()) != NULL))
-    {
-        char ps[10], ts[2];
-
-        itoa(p, ps, 10);
-
-        if(bit >= 0) {
-            strcat(ps, "#");
-            itoa(bit, &ps[strlen(ps)], 10);
-        }
-
-        ts[0] = t;
-        ts[1] = '\0';
+    if(bit >= 0) {
+        strcat(ps, "#");
+        itoa(bit, &ps[strlen(ps)], 10);
+    }
 
-        ok  = cJSON_AddStringToObject(setting, "F", "network") != NULL;
-        ok &= cJSON_AddStringToObject(setting, "P", ps) != NULL;
-        ok &= cJSON_AddStringToObject(setting, "T", ts) != NULL;
-        ok &= cJSON_AddStringToObject(setting, "V", v) != NULL;
-        ok &= cJSON_AddStringToObject(setting, "H", h) != NULL;
+    ts[0] = t;
+    ts[1] = '\0';
 
-        switch(t) {
+    json_start_object(json, NULL);
+    json_add_string(json, "F", "network");
+    json_add_string(json, "P", ps);
+    json_add_string(json, "T", ts);
+    json_add_string(json, "V", v);
+    json_add_string(json, "H", h);
 
-            case WebUIType_Boolean:
-            case WebUIType_Flag:
-                {
-                    uint32_t i, j = strnumentries(s, ',');
-                    char opt[20], val[20];
-                    cJSON *option, *options = cJSON_AddArrayToObject(setting, "O");
+    switch(t) {
 
-                    for(i = 0; i < j; i++) {
-                        option = cJSON_CreateObject();
-                        cJSON_AddStringToObject(option, strgetentry(opt, s, i, ','), strgetentry(val, m, i, ','));
-                        cJSON_AddItemToArray(options, option);
-                    }
+        case WebUIType_Boolean:
+        case WebUIType_Flag:
+            {
+                uint32_t i, j = strnumentries(s, ',');
+                char opt[20], val[20];
+
+                json_start_array(json, "O");
+                for(i = 0; i < j; i++) {
+                    json_start_object(json, NULL);
+                    json_add_string(json, strgetentry(opt, s, i, ','), strgetentry(val, m, i, ','));
+                    json_end_object(json);
                 }
-                break;
-
-            case WebUIType_IPAddress:
-                break;
+                json_end_array(json);
+            }
+            break;
 
-            default:
-                ok &= cJSON_AddStringToObject(setting, "S", s) != NULL;
-                ok &= cJSON_AddStringToObject(setting, "M", m) != NULL;
-                break;
+        case WebUIType_IPAddress:
+            break;
 
-        }
-        if(ok)
-            cJSON_AddItemToArray(settings, setting);
+        default:
+            json_add_string(json, "S", s);
+            json_add_string(json, "M", m);
+            break;
     }
 
-    return ok;
+    json_end_object(json);
+
+    return json->ok;
 }
 
 static bool get_settings (void)
 {
-    bool ok;
+    json_writer_t writer, *settings = &writer;
 
-    cJSON *root = cJSON_CreateObject(), *settings = NULL;
+    webui_print_is_json();
+    json_writer_init(settings, webui_json_sink, NULL);
 
-    if((ok = (root && (settings = cJSON_AddArrayToObject(root, "EEPROM"))))) {
+    json_start_object(settings, NULL);
+    json_start_array(settings, "EEPROM");
 
-
-        webui_print_is_json();
 #if WIFI_ENABLE
 
-        wifi_settings_t *wifi = get_wifi_settings();
+    wifi_settings_t *wifi = get_wifi_settings();
 
-        add_setting(settings, Setting_Hostname, WebUIType_String, -1, wifi->sta.network.hostname, "Hostname", "33", "1");
+    add_setting(settings, Setting_Hostname, WebUIType_String, -1, wifi->sta.network.hostname, "Hostname", "33", "1");
   #if HTTP_ENABLE
-        add_setting(settings, Setting_NetworkServices, WebUIType_Boolean, 2, uitoa(wifi->sta.network.services.http), "HTTP protocol", "Enabled,Disabled", "1,0");
-        add_setting(settings, Setting_HttpPort, WebUIType_Integer, -1, uitoa(wifi->sta.network.http_port), "HTTP Port", "65535", "1");
+    add_setting(settings, Setting_NetworkServices, WebUIType_Boolean, 2, uitoa(wifi->sta.network.services.http), "HTTP protocol", "Enabled,Disabled", "1,0");
+    add_setting(settings, Setting_HttpPort, WebUIType_Integer, -1, uitoa(wifi->sta.network.http_port), "HTTP Port", "65535", "1");
   #endif
   #if TELNET_ENABLE
-        add_setting(settings, Setting_NetworkServices, WebUIType_Boolean, 0, uitoa(wifi->sta.network.services.telnet), "Telnet protocol", "Enabled,Disabled", "1,0");
-        add_setting(settings, Setting_TelnetPort, WebUIType_Integer, -1, uitoa(wifi->sta.network.telnet_port), "Telnet Port", "65535", "1");
+    add_setting(settings, Setting_NetworkServices, WebUIType_Boolean, 0, uitoa(wifi->sta.network.services.telnet), "Telnet protocol", "Enabled,Disabled", "1,0");
+    add_setting(settings, Setting_TelnetPort, WebUIType_Integer, -1, uitoa(wifi->sta.network.telnet_port), "Telnet Port", "65535", "1");
   #endif
-        add_setting(settings, Setting_WifiMode, WebUIType_Boolean, -1, uitoa(wifi->mode), "Radio mode", "None,STA,AP", "0,1,2");
+    add_setting(settings, Setting_WifiMode, WebUIType_Boolean, -1, uitoa(wifi->mode), "Radio mode", "None,STA,AP", "0,1,2");
 
-        add_setting(settings, Setting_WiFi_STA_SSID, WebUIType_String, -1, wifi->sta.ssid, "Station SSID", "32", "1");
-        add_setting(settings, Setting_WiFi_STA_Password, WebUIType_String, -1, HIDDEN_PASSWORD, "Station Password", "64", "1");
-        add_setting(settings, Setting_IpMode, WebUIType_Boolean, -1, uitoa(wifi->sta.network.ip_mode), "Station IP Mode", "DHCP,Static", "1,0");
-        add_setting(settings, Setting_IpAddress, WebUIType_IPAddress, -1, iptoa(&wifi->sta.network.ip), "Station Static IP", "", "");
-        add_setting(settings, Setting_Gateway, WebUIType_IPAddress, -1, iptoa(&wifi->sta.network.gateway), "Station Static Gateway", "", "");
-        add_setting(settings, Setting_NetMask, WebUIType_IPAddress, -1, iptoa(&wifi->sta.network.mask), "Station Static Mask", "", "");
+    add_setting(settings, Setting_WiFi_STA_SSID, WebUIType_String, -1, wifi->sta.ssid, "Station SSID", "32", "1");
+    add_setting(settings, Setting_WiFi_STA_Password, WebUIType_String, -1, HIDDEN_PASSWORD, "Station Password", "64", "1");
+    add_setting(settings, Setting_IpMode, WebUIType_Boolean, -1, uitoa(wifi->sta.network.ip_mode), "Station IP Mode", "DHCP,Static", "1,0");
+    add_setting(settings, Setting_IpAddress, WebUIType_IPAddress, -1, iptoa(&wifi->sta.network.ip), "Station Static IP", "", "");
+    add_setting(settings, Setting_Gateway, WebUIType_IPAddress, -1, iptoa(&wifi->sta.network.gateway), "Station Static Gateway", "", "");
+    add_setting(settings, Setting_NetMask, WebUIType_IPAddress, -1, iptoa(&wifi->sta.network.mask), "Station Static Mask", "", "");
 
-        add_setting(settings, Setting_WiFi_AP_SSID, WebUIType_String, -1, wifi->ap.ssid, "AP SSID", "32", "1");
-        add_setting(settings, Setting_WiFi_AP_Password, WebUIType_String, -1, HIDDEN_PASSWORD, "AP Password", "64", "1");
-        add_setting(settings, Setting_IpAddress2, WebUIType_IPAddress, -1, iptoa(&wifi->ap.network.ip), "AP Static IP", "", "");
+    add_setting(settings, Setting_WiFi_AP_SSID, WebUIType_String, -1, wifi->ap.ssid, "AP SSID", "32", "1");
+    add_setting(settings, Setting_WiFi_AP_Password, WebUIType_String, -1, HIDDEN_PASSWORD, "AP Password", "64", "1");
+    add_setting(settings, Setting_IpAddress2, WebUIType_IPAddress, -1, iptoa(&wifi->ap.network.ip), "AP Static IP", "", "");
 
 #endif
 #if BLUETOOTH_ENABLE
 //      add_setting(settings, Setting_WifiMode, WebUIType_Boolean, -1, uitoa(wifi->mode), "Radio mode", "None,BT", "0,1");
 #endif
 
-        char *resp = cJSON_PrintUnformatted(root);
-
-        webui_print(resp);
-/*
-        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
-        httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-        httpd_resp_send(req, resp, strlen(resp));
-*/
-        free(resp);
+    json_end_array(settings);
+    json_end_object(settings);
 
-    }
-
-    if(root)
-        cJSON_Delete(root);
-
-    return ok;
+    return json_writer_end(settings);
 }
 
 static void set_setting (char *args)
@@ -661,19 +648,75 @@ status_code_t webui_command_handler (uint32_t command, char *args)
             }
             break;
 
-        case WebUICmd_ReadLocalFile:
+        case WebUICmd_ReadLocalFile: // [ESP700]<filename>[ line=<n>]
             status = Status_IdleError;
             if(hal.stream.type != StreamType_FlashFs) { // Already streaming a file?
-                char *cmd = get_arg(args, NULL, false);
+                uint32_t line = 0;
+                char *cmd = get_arg(args, NULL, false), *start;
+                if((start = strstr(cmd, " line="))) {
+                    *start = '\0';
+                    line = strtoul(start + 6, NULL, 10);
+                }
                 if(strlen(cmd) > 0) {
                     strcpy(response, "/spiffs");
                     strcat(response, cmd);
-                    status = report_status_message(flashfs_stream_file(response));
+                    status = report_status_message(flashfs_stream_file_at(response, line));
                 }
             }
             webui_print(status == Status_OK ? "ok" : "error:cannot stream file");
             break;
 
+        case WebUICmd_IndexLocalFile: // [ESP701]<filename>
+            {
+                char *cmd = get_arg(args, NULL, false);
+                status = Status_InvalidStatement;
+                if(strlen(cmd) > 0) {
+                    strcpy(response, "/spiffs");
+                    strcat(response, cmd);
+                    status = flashfs_index_file(response);
+                }
+                webui_print(status == Status_OK ? "ok" : "error:cannot index file");
+            }
+            break;
+
+        case WebUICmd_QueueLocalFile: // [ESP702]<filename>[ repeat=<n>]
+            {
+                uint32_t repeat = 1;
+                char *cmd = get_arg(args, NULL, false), *start;
+                if((start = strstr(cmd, " repeat="))) {
+                    *start = '\0';
+                    repeat = strtoul(start + 8, NULL, 10);
+                }
+                status = Status_InvalidStatement;
+                if(strlen(cmd) > 0) {
+                    strcpy(response, "/spiffs");
+                    strcat(response, cmd);
+                    status = flashfs_queue_job(response, repeat);
+                }
+                webui_print(status == Status_OK ? "ok" : "error:cannot queue file");
+            }
+            break;
+
+        case WebUICmd_GetClearJobQueue: // [ESP703][CLEAR]
+            {
+                char *cmd = get_arg(args, NULL, false);
+                if(!strcmp(cmd, "CLEAR")) {
+                    flashfs_clear_queue();
+                    webui_print("ok");
+                } else if(*cmd)
+                    webui_print("error:Incorrect Command");
+                else {
+                    uint32_t repeat;
+                    uint_fast8_t idx = 0;
+                    const char *name;
+                    while((name = flashfs_queued_job(idx++, &repeat)))
+                        webui_print_chunk(strappend(response, 4, name + 7, " x", uitoa(repeat), "\n"));
+                    if(idx == 1)
+                        webui_print("No jobs queued");
+                }
+            }
+            break;
+
         case WebUICmd_FormatFlashFS:
             {
                 char *cmd = get_arg(args, NULL, false);
@@ -682,6 +725,7 @@ status_code_t webui_command_handler (uint32_t command, char *args)
                     webui_print_chunk("Formating"); // sic
                     if(esp_spiffs_format(NULL) == ESP_OK)
                         status = Status_OK;
+                    http_path_cache_invalidate();
                 }
                 webui_print(status == Status_OK ? "...Done\n" : "error\n");
             }
@@ -753,6 +797,9 @@ webui_auth_level_t get_auth_required (uint32_t command, char *args)
         case WebUICmd_GetAPList:
         case WebUICmd_GetStatus:
         case WebUICmd_ReadLocalFile:
+        case WebUICmd_IndexLocalFile:
+        case WebUICmd_QueueLocalFile:
+        case WebUICmd_GetClearJobQueue:
         case WebUICmd_GetFlashFSCapacity:
             level = WebUIAuth_User;
             break;
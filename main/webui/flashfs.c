@@ -26,31 +26,131 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 
 #include "grbl/settings.h"
 #include "grbl/report.h"
 #include "grbl/state_machine.h"
+#include "grbl/protocol.h"
 
 #include "flashfs.h"
+#include "web/backend.h"
 #include <esp_log.h>
 
+#include "freertos/task.h"
+#include "esp32/rom/miniz.h"
+
+#define FLASHFS_PREFETCH_SIZE   8192    // read-ahead ring buffer size, must be a power of 2
+#define FLASHFS_BLOCK_SIZE      1024    // read block size
+#define FLASHFS_PREFETCH_STACK  4096    // prefetch task stack size, SPIFFS reads via VFS and the inflater need more than 2K
+#define FILE_UNDERRUN           -2      // no data available yet
+#define FILE_ERROR              -3      // read error or corrupt data
+#define FLASHFS_INDEX_MAGIC     0x3158494C // "LIX1"
+#define FLASHFS_INDEX_STRIDE    32      // lines per index entry
+#define FLASHFS_PATH_MAX        64
+#define FLASHFS_QUEUE_MAX       8       // max number of jobs waiting in the queue
+
 typedef struct
 {
-    FILE *handle;
+    int handle;
     char name[50];
     size_t size;
-    size_t pos;
+    size_t pos;             // number of characters handed out
     uint32_t line;
     uint8_t eol;
+    bool gzip;
+    bool chained;           // set when the job was switched to without leaving the stream, cleared on first character read
+    uint32_t repeat;        // number of times left to run the job, including the current run
 } file_t;
 
+// Jobs run back to back, the next job is opened when the current one is exhausted
+// so that the planner does not run dry between them.
+typedef struct
+{
+    char name[FLASHFS_PATH_MAX];
+    uint32_t repeat;
+} job_t;
+
+typedef struct
+{
+    uint_fast8_t head;
+    uint_fast8_t count;
+    job_t job[FLASHFS_QUEUE_MAX];
+} job_queue_t;
+
+// gzip compressed files are inflated by the prefetch task with the ROM inflater,
+// the dictionary doubles as the output buffer and must hold the full 32K deflate window.
+typedef struct
+{
+    tinfl_decompressor decomp;
+    tinfl_status status;
+    bool in_eof;
+    const uint8_t *in_next;
+    const uint8_t *in_end;
+    uint8_t *out;           // inflated data not yet copied to the ring buffer
+    size_t pending;
+    size_t dict_ofs;
+    uint8_t in[FLASHFS_BLOCK_SIZE];
+    uint8_t dict[TINFL_LZ_DICT_SIZE];
+} inflate_t;
+
+// The file is read ahead into a ring buffer by a task on core 0 so that filesystem stalls
+// (SPIFFS garbage collection etc.) are absorbed by buffered data instead of starving the planner.
+typedef struct
+{
+    TaskHandle_t task;
+    SemaphoreHandle_t done;
+    volatile bool stop;
+    volatile bool eof;      // set with release ordering after the last block has been added
+    volatile bool error;    // set before eof if reading or inflating failed
+    volatile uint32_t head; // advanced by the prefetch task
+    volatile uint32_t tail; // advanced by the consumer
+    bool starved;           // consumer has found the ring buffer empty, set until data arrives
+    uint32_t underruns;     // number of times the ring buffer ran dry after the first block
+    char *data;
+    inflate_t *inflate;
+} prefetch_t;
+
+/*
+  Line index, cached as <file>.idx next to the file:
+
+    header:  index_header_t
+    entries: uint32 offset of line 1, 1 + stride, 1 + 2 * stride, ...
+
+  The index is valid as long as the size and modification time of the file match the header.
+*/
+typedef struct
+{
+    uint32_t magic;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t stride;
+    uint32_t lines;
+    uint32_t entries;
+} index_header_t;
+
+// Background line index scan, if line is > 0 the job is started at that line when the scan completes.
+typedef struct
+{
+    TaskHandle_t task;
+    volatile bool ok;
+    uint32_t line;
+    uint32_t offset;        // offset of line, valid when ok is true
+    char filename[FLASHFS_PATH_MAX];
+} indexer_t;
+
 static file_t file = {
-    .handle = NULL,
+    .handle = -1,
     .size = 0,
     .pos = 0
 };
 
+static prefetch_t prefetch = {0};
+static indexer_t indexer = {0};
+static job_queue_t queue = {0};
+static portMUX_TYPE queue_mux = portMUX_INITIALIZER_UNLOCKED; // jobs are added by the http task and consumed by the grbl task
 static bool frewind = false;
 static io_stream_t active_stream;
 static driver_reset_ptr driver_reset = NULL;
@@ -63,43 +163,317 @@ static void flashfs_end_job (void);
 static void flashfs_report (stream_write_ptr stream_write, report_tracking_flags_t report);
 static void trap_state_change_request(uint_fast16_t state);
 static void flashfs_on_program_completed (program_flow_t program_flow, bool check_mode);
+static status_code_t trap_status_report (status_code_t status_code);
 
 //static report_t active_reports;
 
+// Copies data to the ring buffer, returns the number of bytes copied.
+static size_t prefetch_put (const uint8_t *data, size_t length)
+{
+    size_t n, copied = 0;
+    uint32_t head = prefetch.head, offset = head & (FLASHFS_PREFETCH_SIZE - 1);
+
+    length = min(length, FLASHFS_PREFETCH_SIZE - (head - __atomic_load_n(&prefetch.tail, __ATOMIC_ACQUIRE)));
+
+    while(length) {
+        n = min(length, FLASHFS_PREFETCH_SIZE - offset);
+        memcpy(prefetch.data + offset, data, n);
+        data += n;
+        copied += n;
+        length -= n;
+        offset = 0;
+    }
+
+    __atomic_store_n(&prefetch.head, head + copied, __ATOMIC_RELEASE);
+
+    return copied;
+}
+
+static void prefetch_end (bool error)
+{
+    prefetch.error = error;
+    __atomic_store_n(&prefetch.eof, true, __ATOMIC_RELEASE);
+}
+
+// Reads a block if there is room for it, returns false if the ring buffer is full.
+static bool prefetch_read (void)
+{
+    ssize_t length;
+    uint32_t head = prefetch.head, offset = head & (FLASHFS_PREFETCH_SIZE - 1);
+
+    if(FLASHFS_PREFETCH_SIZE - (head - __atomic_load_n(&prefetch.tail, __ATOMIC_ACQUIRE)) < FLASHFS_BLOCK_SIZE)
+        return false;
+
+    if((length = read(file.handle, prefetch.data + offset, min(FLASHFS_BLOCK_SIZE, FLASHFS_PREFETCH_SIZE - offset))) > 0)
+        __atomic_store_n(&prefetch.head, head + length, __ATOMIC_RELEASE);
+    else
+        prefetch_end(length < 0);
+
+    return true;
+}
+
+// Inflates the next part of the file or moves pending output to the ring buffer, returns false if the ring buffer is full.
+static bool prefetch_inflate (inflate_t *inflate)
+{
+    if(inflate->pending) {
+        size_t n = prefetch_put(inflate->out, inflate->pending);
+        inflate->out += n;
+        inflate->pending -= n;
+        return n != 0;
+    }
+
+    if(inflate->status != TINFL_STATUS_NEEDS_MORE_INPUT && inflate->status != TINFL_STATUS_HAS_MORE_OUTPUT) {
+        prefetch_end(inflate->status != TINFL_STATUS_DONE);
+        return true;
+    }
+
+    if(inflate->in_next == inflate->in_end && !inflate->in_eof) {
+
+        ssize_t length = read(file.handle, inflate->in, sizeof(inflate->in));
+
+        if(length < 0) {
+            prefetch_end(true);
+            return true;
+        }
+
+        inflate->in_eof = length == 0;
+        inflate->in_next = inflate->in;
+        inflate->in_end = inflate->in + length;
+    }
+
+    size_t in_bytes = inflate->in_end - inflate->in_next, out_bytes = TINFL_LZ_DICT_SIZE - inflate->dict_ofs;
+
+    inflate->status = tinfl_decompress(&inflate->decomp, inflate->in_next, &in_bytes, inflate->dict, inflate->dict + inflate->dict_ofs,
+                                        &out_bytes, inflate->in_eof ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+
+    if(inflate->status == TINFL_STATUS_NEEDS_MORE_INPUT && inflate->in_eof)
+        inflate->status = TINFL_STATUS_FAILED; // truncated file
+
+    if(inflate->status < TINFL_STATUS_DONE)
+        out_bytes = 0; // corrupt data, do not pass any more on
+
+    inflate->in_next += in_bytes;
+    inflate->out = inflate->dict + inflate->dict_ofs;
+    inflate->pending = out_bytes;
+    inflate->dict_ofs = (inflate->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+    return true;
+}
+
+// Fills the ring buffer, waits for the consumer to free space when it is full.
+// The task is kept alive after end of file until prefetch_stop() ends it.
+static void prefetch_task (void *arg)
+{
+    while(!prefetch.stop) {
+        if(prefetch.eof)
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        else if(!(prefetch.inflate ? prefetch_inflate(prefetch.inflate) : prefetch_read()))
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+    }
+
+    xSemaphoreGive(prefetch.done);
+    vTaskDelete(NULL);
+}
+
+static bool prefetch_start (void)
+{
+    prefetch.head = prefetch.tail = 0;
+    prefetch.stop = prefetch.eof = prefetch.error = false;
+    prefetch.starved = true; // no underrun until the first block has arrived
+    prefetch.underruns = 0;
+
+    if(prefetch.done == NULL && (prefetch.done = xSemaphoreCreateBinary()) == NULL)
+        return false;
+
+    if(prefetch.data == NULL && (prefetch.data = malloc(FLASHFS_PREFETCH_SIZE)) == NULL)
+        return false;
+
+    if(file.gzip) {
+        if(prefetch.inflate == NULL && (prefetch.inflate = malloc(sizeof(inflate_t))) == NULL)
+            return false;
+        tinfl_init(&prefetch.inflate->decomp);
+        prefetch.inflate->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+        prefetch.inflate->in_eof = false;
+        prefetch.inflate->in_next = prefetch.inflate->in_end = prefetch.inflate->in;
+        prefetch.inflate->pending = prefetch.inflate->dict_ofs = 0;
+    }
+
+    if(xTaskCreatePinnedToCore(prefetch_task, "prefetch", FLASHFS_PREFETCH_STACK, NULL, 2, &prefetch.task, 0) != pdPASS) {
+        prefetch.task = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void prefetch_stop (void)
+{
+    if(prefetch.task) {
+        prefetch.stop = true;
+        xTaskNotifyGive(prefetch.task);
+        xSemaphoreTake(prefetch.done, portMAX_DELAY);
+        prefetch.task = NULL;
+    }
+
+    if(prefetch.data) {
+        free(prefetch.data);
+        prefetch.data = NULL;
+    }
+
+    if(prefetch.inflate) {
+        free(prefetch.inflate);
+        prefetch.inflate = NULL;
+    }
+}
+
 static void file_close (void)
 {
-    if(file.handle) {
-        fclose(file.handle);
-        file.handle = NULL;
+    prefetch_stop();
+
+    if(file.handle >= 0) {
+        close(file.handle);
+        file.handle = -1;
+    }
+}
+
+// Reads forward from the current position past skip line terminators, returns the new position or -1 on failure.
+static off_t file_skip_lines (off_t offset, uint32_t skip)
+{
+    char buf[128];
+    ssize_t length, i;
+
+    while(skip) {
+
+        if((length = read(file.handle, buf, sizeof(buf))) <= 0)
+            return -1;
+
+        for(i = 0; i < length && skip; i++) {
+            if(buf[i] == '\n')
+                skip--;
+        }
+
+        offset += i;
+    }
+
+    return lseek(file.handle, offset, SEEK_SET);
+}
+
+static bool is_gzip_name (const char *filename)
+{
+    size_t len = strlen(filename);
+
+    return len > 3 && !strcasecmp(filename + len - 3, ".gz");
+}
+
+// Positions the file at the start of the deflate data and gets the inflated size from the trailer,
+// returns false if the file is not gzip compressed.
+static bool gzip_open (int fd, size_t *size)
+{
+    uint8_t hdr[10], c;
+    uint32_t isize;
+    off_t start;
+
+    if(read(fd, hdr, sizeof(hdr)) != sizeof(hdr) || hdr[0] != 0x1F || hdr[1] != 0x8B || hdr[2] != 8)
+        return false;
+
+    if(hdr[3] & 0x04) { // FEXTRA
+        if(read(fd, hdr, 2) != 2 || lseek(fd, hdr[0] | (hdr[1] << 8), SEEK_CUR) < 0)
+            return false;
+    }
+
+    if(hdr[3] & 0x08) { // FNAME
+        do {
+            if(read(fd, &c, 1) != 1)
+                return false;
+        } while(c);
+    }
+
+    if(hdr[3] & 0x10) { // FCOMMENT
+        do {
+            if(read(fd, &c, 1) != 1)
+                return false;
+        } while(c);
     }
+
+    if(hdr[3] & 0x02) // FHCRC
+        lseek(fd, 2, SEEK_CUR);
+
+    if((start = lseek(fd, 0, SEEK_CUR)) < 0 || lseek(fd, -4, SEEK_END) < 0 || read(fd, &isize, sizeof(uint32_t)) != sizeof(uint32_t))
+        return false;
+
+    *size = isize; // modulo 2^32, fine for job files
+
+    return lseek(fd, start, SEEK_SET) == start;
 }
 
-static bool file_open (char *filename)
+// Opens the file positioned skip lines after offset, offset must be the start of a line.
+// gzip compressed files are always read from the start.
+static bool file_open (char *filename, off_t offset, uint32_t skip)
 {
     struct stat st;
 
-    if(file.handle)
+    if(file.handle >= 0)
         file_close();
 
-    if(stat(filename, &st) == 0 && (file.handle = fopen(filename, "r"))) {
+    if(stat(filename, &st) == 0 && (file.handle = open(filename, O_RDONLY)) >= 0) {
         file.size = st.st_size;
-        file.pos = 0;
         file.line = 0;
         file.eol = false;
         char *leafname = strrchr(filename, '/');
         strncpy(file.name, leafname ? leafname + 1 : filename, sizeof(file.name));
         file.name[sizeof(file.name) - 1] = '\0';
+        if((file.gzip = is_gzip_name(filename))) {
+            offset = 0;
+            if(!gzip_open(file.handle, &file.size))
+                offset = -1;
+        } else if((offset || skip) && (lseek(file.handle, offset, SEEK_SET) != offset || (offset = file_skip_lines(offset, skip)) < 0))
+            offset = -1;
+        if(offset < 0)
+            file_close();
+        else {
+            file.pos = offset;
+            if(!prefetch_start())
+                file_close();
+        }
     }
 
-    return file.handle != NULL;
+    return file.handle >= 0;
 }
 
-static int16_t file_read (void)
+static bool file_rewind (void)
 {
-    int c;
+    size_t size;
+
+    prefetch_stop();
+
+    return file.handle >= 0 && lseek(file.handle, 0, SEEK_SET) == 0 && (!file.gzip || gzip_open(file.handle, &size)) && prefetch_start();
+}
 
-    if((c = fgetc(file.handle)) != EOF)
-        file.pos = ftell(file.handle);
+// Only consumes buffered data, returns FILE_UNDERRUN if the prefetch task has not caught up.
+static int16_t file_read (void)
+{
+    int c = EOF;
+    bool eof = __atomic_load_n(&prefetch.eof, __ATOMIC_ACQUIRE); // must be read before head
+    uint32_t tail = prefetch.tail;
+
+    if(tail != __atomic_load_n(&prefetch.head, __ATOMIC_ACQUIRE)) {
+        c = (uint8_t)prefetch.data[tail & (FLASHFS_PREFETCH_SIZE - 1)];
+        __atomic_store_n(&prefetch.tail, ++tail, __ATOMIC_RELEASE);
+        prefetch.starved = false;
+        file.pos++;
+        if(FLASHFS_PREFETCH_SIZE - (prefetch.head - tail) == FLASHFS_BLOCK_SIZE && prefetch.task)
+            xTaskNotifyGive(prefetch.task); // room for another block
+    } else if(eof && prefetch.error)
+        return FILE_ERROR;
+    else if(!eof) {
+        if(!prefetch.starved) {
+            prefetch.starved = true;
+            prefetch.underruns++;
+        }
+        if(file.eol == 1)
+            file.eol++; // line has been counted, do not count it again on the next call
+        return FILE_UNDERRUN;
+    }
 
     if(c == '\r' || c == '\n')
         file.eol++;
@@ -109,10 +483,61 @@ static int16_t file_read (void)
     return (int16_t)c;
 }
 
+// Continues with the next run of the current job or the next queued job, returns false if there is none.
+static bool job_next (void)
+{
+    job_t job;
+
+    if(file.repeat > 1 && file_rewind()) {
+        file.repeat--;
+        file.pos = file.line = 0;
+        file.eol = 0;
+        file.chained = true;
+        return true;
+    }
+
+    while(true) {
+
+        portENTER_CRITICAL(&queue_mux);
+        if(queue.count) {
+            memcpy(&job, &queue.job[queue.head], sizeof(job_t));
+            queue.head = (queue.head + 1) % FLASHFS_QUEUE_MAX;
+            queue.count--;
+        } else
+            *job.name = '\0';
+        portEXIT_CRITICAL(&queue_mux);
+
+        if(*job.name == '\0')
+            break;
+
+        if(file_open(job.name, 0, 0)) {
+            file.repeat = job.repeat;
+            file.chained = true;
+            return true;
+        }
+
+        char buf[FLASHFS_PATH_MAX + 30];
+        sprintf(buf, "[MSG:Cannot open queued job %s]" ASCII_EOL, job.name);
+        hal.stream.write(buf);
+    }
+
+    return false;
+}
+
+// Called on program end (M2/M30), the planner has been drained by then.
+static void job_end (void)
+{
+    if(!(file.chained || job_next()))
+        flashfs_end_job();
+}
+
 static void flashfs_end_job (void)
 {
     file_close();
 
+    flashfs_clear_queue();
+    file.chained = false;
+
     if(grbl.on_realtime_report == flashfs_report)
         grbl.on_realtime_report = on_realtime_report;
 
@@ -131,6 +556,13 @@ static void flashfs_end_job (void)
 
     report_init_fns();
 
+    if(prefetch.underruns) {
+        char buf[50];
+        sprintf(buf, "[MSG:Prefetch underruns: %u]" ASCII_EOL, (unsigned int)prefetch.underruns);
+        hal.stream.write(buf);
+        prefetch.underruns = 0;
+    }
+
     frewind = false;
 
     if(grbl.on_stream_changed)
@@ -139,7 +571,7 @@ static void flashfs_end_job (void)
 
 static void flashfs_on_program_completed (program_flow_t program_flow, bool check_mode)
 {
-    flashfs_end_job();
+    job_end();
 
     if(on_program_completed)
         on_program_completed(program_flow, check_mode);
@@ -153,14 +585,26 @@ ISR_CODE static int16_t flashfs_read (void)
     if(file.eol == 1)
         file.line++;
 
-    if(file.handle) {
+    if(file.handle >= 0) {
 
-        if(state == STATE_IDLE || (state & (STATE_CYCLE|STATE_HOLD)))
-            c = file_read();
+        if(!(state == STATE_IDLE || (state & (STATE_CYCLE|STATE_HOLD)))) {
+            if(file.eol == 1)
+                file.eol++; // line has been counted, do not count it again on the next call
+            return -1;      // grbl is not accepting input, keep the file and the queue as they are
+        }
 
-        if(c == -1) { // EOF or error reading or grbl problem
-            file_close();
-            if(file.eol == 0) // Return newline if line was incorrectly terminated
+        if((c = file_read()) >= 0)
+            file.chained = false;
+        else if(c == FILE_UNDERRUN)
+            c = -1;
+        else if(c == FILE_ERROR) {
+            c = -1;
+            trap_status_report(Status_SDReadError); // reports the error and ends the job
+        } else { // EOF
+            bool terminated = file.eol != 0; // must be read before the next job is opened
+            if(!job_next())     // Switch to the next job while the planner still holds motion from this one
+                file_close();
+            if(!terminated) // Return newline if line was incorrectly terminated
                 c = '\n';
         }
 
@@ -221,14 +665,14 @@ static message_code_t trap_feedback_message (message_code_t message_code)
 
     if(message_code == Message_ProgramEnd) {
         if(frewind) {
-            fseek(file.handle, 0, SEEK_SET);
+            file_rewind();
             file.pos = file.line = 0;
             file.eol = false;
             report_feedback_message(Message_CycleStartToRerun);
             hal.stream.read = await_cycle_start;
             grbl.on_state_change = trap_state_change_request;
         } else
-            flashfs_end_job();
+            job_end();
     }
 
     return message_code;
@@ -236,13 +680,13 @@ static message_code_t trap_feedback_message (message_code_t message_code)
 
 static void flashfs_report (stream_write_ptr stream_write, report_tracking_flags_t report)
 {
-    char *pct_done = ftoa((float)file.pos / (float)file.size * 100.0f, 1);
+    char *pct_done = ftoa(file.size ? (float)file.pos / (float)file.size * 100.0f : 100.0f, 1);
 
     if(state_get() != STATE_IDLE && !strncmp(pct_done, "100.0", 5))
         strcpy(pct_done, "99.9");
 
     stream_write("|SD:");
-    stream_write(ftoa((float)file.pos / (float)file.size * 100.0f, 1));
+    stream_write(pct_done);
     stream_write(",");
     stream_write(file.name);
 
@@ -269,14 +713,17 @@ static bool flashfs_suspend (bool suspend)
 }
 #endif
 
-status_code_t flashfs_stream_file (char *filename)
+static status_code_t stream_start (char *filename, off_t offset, uint32_t skip, uint32_t line)
 {
     status_code_t retval = Status_Unhandled;
 
     if (state_get() != STATE_IDLE)
         retval = Status_SystemGClock;
     else {
-        if(file_open(filename)) {
+        if(file_open(filename, offset, skip)) {
+            file.line = line;
+            file.repeat = 1;
+            file.chained = false;
             gc_state.last_error = Status_OK;                            // Start with no errors
             grbl.report.status_message(Status_OK);                      // and confirm command to originator
             memcpy(&active_stream, &hal.stream, sizeof(io_stream_t));   // Save current stream pointers
@@ -309,6 +756,247 @@ status_code_t flashfs_stream_file (char *filename)
     return retval;
 }
 
+static bool index_name (char *name, const char *filename)
+{
+    return strlen(filename) + sizeof(".idx") <= FLASHFS_PATH_MAX && strcat(strcpy(name, filename), ".idx");
+}
+
+// Looks up the closest indexed line at or before line, returns false if there is no valid index or the line is beyond the end of the file.
+static bool index_lookup (const char *filename, uint32_t line, off_t *offset, uint32_t *skip)
+{
+    bool ok = false;
+    FILE *idx;
+    struct stat st;
+    uint32_t entry = (line - 1) / FLASHFS_INDEX_STRIDE, pos;
+    index_header_t hdr;
+    char name[FLASHFS_PATH_MAX];
+
+    if(!index_name(name, filename) || stat(filename, &st) != 0 || (idx = fopen(name, "rb")) == NULL)
+        return false;
+
+    if(fread(&hdr, sizeof(index_header_t), 1, idx) == 1 &&
+        hdr.magic == FLASHFS_INDEX_MAGIC && hdr.stride == FLASHFS_INDEX_STRIDE &&
+         hdr.size == (uint32_t)st.st_size && hdr.mtime == (uint32_t)st.st_mtime &&
+          line <= hdr.lines && entry < hdr.entries &&
+           fseek(idx, sizeof(index_header_t) + entry * sizeof(uint32_t), SEEK_SET) == 0 &&
+            fread(&pos, sizeof(uint32_t), 1, idx) == 1) {
+        *offset = pos;
+        *skip = (line - 1) % FLASHFS_INDEX_STRIDE;
+        ok = true;
+    }
+
+    fclose(idx);
+
+    return ok;
+}
+
+// Runs in the foreground, starts the job if requested when the index scan was launched.
+static void index_done (sys_state_t state)
+{
+    char msg[FLASHFS_PATH_MAX + 40];
+    uint32_t line = indexer.line;
+
+    indexer.line = 0;
+
+    if(line == 0)
+        sprintf(msg, indexer.ok ? "Indexed %s" : "Failed to index %s", indexer.filename);
+    else if(!(indexer.ok && indexer.offset && stream_start(indexer.filename, indexer.offset, 0, line - 1) == Status_OK))
+        sprintf(msg, "Cannot start %s at line %u", indexer.filename, (unsigned int)line);
+    else
+        return;
+
+    report_message(msg, Message_Info);
+}
+
+// Scans the file for line terminators, writes the index next to it and finds the offset of the requested line.
+// The scan is completed even if the index cannot be written (e.g. when the name is too long).
+static void index_task (void *arg)
+{
+    int fd;
+    FILE *idx = NULL;
+    ssize_t length = -1, i;
+    struct stat st;
+    uint32_t lines = 0, offset = 0;
+    char name[FLASHFS_PATH_MAX], last = '\n', *buf = malloc(FLASHFS_BLOCK_SIZE);
+    index_header_t hdr = {
+        .magic = FLASHFS_INDEX_MAGIC,
+        .stride = FLASHFS_INDEX_STRIDE,
+        .entries = 1
+    };
+
+    indexer.offset = 0;
+
+    if(buf && stat(indexer.filename, &st) == 0 && (fd = open(indexer.filename, O_RDONLY)) >= 0) {
+
+        hdr.size = st.st_size;
+        hdr.mtime = st.st_mtime;
+
+        // The header is written again with the line and entry counts when done, the first entry is line 1 at offset 0
+        if(index_name(name, indexer.filename) && (idx = fopen(name, "wb")) &&
+            (fwrite(&hdr, sizeof(index_header_t), 1, idx) != 1 || fwrite(&offset, sizeof(uint32_t), 1, idx) != 1)) {
+            fclose(idx);
+            unlink(name);
+            idx = NULL;
+        }
+
+        while((length = read(fd, buf, FLASHFS_BLOCK_SIZE)) > 0) {
+
+            for(i = 0; i < length; i++) {
+                if(buf[i] == '\n') {
+                    uint32_t next = offset + i + 1;
+                    if(++lines == indexer.line - 1)
+                        indexer.offset = next;
+                    if(idx && lines % FLASHFS_INDEX_STRIDE == 0) {
+                        fwrite(&next, sizeof(uint32_t), 1, idx);
+                        hdr.entries++;
+                    }
+                }
+            }
+
+            last = buf[length - 1];
+            offset += length;
+        }
+
+        if(last != '\n')
+            lines++; // last line is not terminated
+
+        close(fd);
+    }
+
+    bool scanned = length == 0, saved = false;
+
+    if(idx) {
+        hdr.lines = lines;
+        saved = scanned && fseek(idx, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(index_header_t), 1, idx) == 1;
+        if(fclose(idx) != 0 || !saved) {
+            unlink(name);
+            saved = false;
+        }
+        http_path_cache_invalidate();
+    }
+
+    indexer.ok = indexer.line ? scanned : saved;
+
+    if(buf)
+        free(buf);
+
+    indexer.task = NULL;
+    protocol_enqueue_rt_command(index_done);
+
+    vTaskDelete(NULL);
+}
+
+// Starts a background scan on core 0, completion is reported by index_done().
+static status_code_t index_start (char *filename, uint32_t line)
+{
+    if(indexer.task || strlen(filename) >= sizeof(indexer.filename))
+        return Status_IdleError;
+
+    strcpy(indexer.filename, filename);
+    indexer.line = line;
+    indexer.ok = false;
+
+    if(xTaskCreatePinnedToCore(index_task, "index", 3072, NULL, 1, &indexer.task, 0) != pdPASS) {
+        indexer.task = NULL;
+        return Status_IdleError;
+    }
+
+    return Status_OK;
+}
+
+status_code_t flashfs_stream_file (char *filename)
+{
+    return stream_start(filename, 0, 0, 0);
+}
+
+// Starts the job at line, seeking via the line index if there is a valid one.
+// If not the index is built first and the job started when done.
+// NOTE: modal state (units, work offset, spindle etc.) set by skipped lines is not restored.
+status_code_t flashfs_stream_file_at (char *filename, uint32_t line)
+{
+    off_t offset;
+    uint32_t skip;
+
+    if(line <= 1)
+        return flashfs_stream_file(filename);
+
+    if(state_get() != STATE_IDLE)
+        return Status_SystemGClock;
+
+    if(is_gzip_name(filename))
+        return Status_InvalidStatement; // compressed files cannot be indexed
+
+    if(index_lookup(filename, line, &offset, &skip))
+        return stream_start(filename, offset, skip, line - 1);
+
+    return index_start(filename, line);
+}
+
+// Builds the line index in the background.
+status_code_t flashfs_index_file (char *filename)
+{
+    return is_gzip_name(filename) ? Status_InvalidStatement : index_start(filename, 0);
+}
+
+// Starts the job if no job is running, adds it to the queue if one is.
+status_code_t flashfs_queue_job (char *filename, uint32_t repeat)
+{
+    job_t *job;
+    status_code_t status;
+
+    if(repeat == 0 || strlen(filename) >= FLASHFS_PATH_MAX)
+        return Status_InvalidStatement;
+
+    if(hal.stream.type != StreamType_FlashFs) {
+        if(indexer.task)
+            return Status_IdleError;
+        if((status = stream_start(filename, 0, 0, 0)) == Status_OK)
+            file.repeat = repeat;
+        return status;
+    }
+
+    portENTER_CRITICAL(&queue_mux);
+
+    if((status = queue.count == FLASHFS_QUEUE_MAX ? Status_IdleError : Status_OK) == Status_OK) {
+        job = &queue.job[(queue.head + queue.count) % FLASHFS_QUEUE_MAX];
+        strcpy(job->name, filename);
+        job->repeat = repeat;
+        queue.count++;
+    }
+
+    portEXIT_CRITICAL(&queue_mux);
+
+    return status;
+}
+
+// Returns the name of the queued job at index, NULL if there is none.
+// The name is copied and valid until the next call.
+const char *flashfs_queued_job (uint_fast8_t index, uint32_t *repeat)
+{
+    static job_t job;
+    bool ok;
+
+    portENTER_CRITICAL(&queue_mux);
+    if((ok = index < queue.count))
+        memcpy(&job, &queue.job[(queue.head + index) % FLASHFS_QUEUE_MAX], sizeof(job_t));
+    portEXIT_CRITICAL(&queue_mux);
+
+    if(!ok)
+        return NULL;
+
+    *repeat = job.repeat;
+
+    return job.name;
+}
+
+// Removes all queued jobs, the running job is not affected.
+void flashfs_clear_queue (void)
+{
+    portENTER_CRITICAL(&queue_mux);
+    queue.count = 0;
+    portEXIT_CRITICAL(&queue_mux);
+}
+
 void flashfs_reset (void)
 {
     if(hal.stream.type == StreamType_FlashFs) {
@@ -28,5 +28,10 @@
 void flashfs_init (void);
 void flashfs_reset (void);
 status_code_t flashfs_stream_file (char *filename);
+status_code_t flashfs_stream_file_at (char *filename, uint32_t line);
+status_code_t flashfs_index_file (char *filename);
+status_code_t flashfs_queue_job (char *filename, uint32_t repeat);
+const char *flashfs_queued_job (uint_fast8_t index, uint32_t *repeat);
+void flashfs_clear_queue (void);
 
 #endif
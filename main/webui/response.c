@@ -38,11 +38,14 @@
 #include "webui.h"
 #include "grbl/grbl.h"
 #include "grbl/protocol.h"
+#include "web/deflate.h"
+#include "web/json_writer.h"
 
 static const char *TAG = "webui";
 
 static bool chunked = false;
 static httpd_req_t *http_request = NULL;
+static deflate_t *deflate = NULL;
 static on_report_options_ptr on_report_options;
 
 static status_code_t webui_parse_command (char *cmd)
@@ -120,33 +123,46 @@ void webui_init (void)
 void webui_set_http_request (httpd_req_t *req)
 {
     chunked = false;
+    deflate = NULL;
     http_request = req;
     httpd_resp_set_hdr(http_request, "Cache-Control", "no-cache");
 }
 
-void webui_print (const char *s)
+// Writes length characters of s to the stream, via a small stack buffer if the stream cannot write counted strings.
+static void write_n (const char *s, size_t length)
 {
-    if(http_request)
-        httpd_resp_sendstr(http_request, s);
+    if(hal.stream.write_n)
+        hal.stream.write_n(s, length);
     else {
+        char buf[65];
+        size_t n;
+        while(length) {
+            n = length < sizeof(buf) - 1 ? length : sizeof(buf) - 1;
+            memcpy(buf, s, n);
+            buf[n] = '\0';
+            hal.stream.write(buf);
+            s += n;
+            length -= n;
+        }
+    }
+}
+
+void webui_print (const char *s)
+{
+    if(http_request) {
         size_t len = strlen(s);
-        if(len) {
-            if(s[--len] == '\n') {
-                char *t = malloc(len + 3);
-                if(t) {
-                    memcpy(t, s, len);
-                    t[len++] = '\r';
-                    t[len++] = '\n';
-                    t[len] = '\0';
-                    hal.stream.write(t);
-                    free(t);
-                }
-            } else {
-                hal.stream.write(s);
-                hal.stream.write(ASCII_EOL);
-            }
+        if(!chunked && len >= DEFLATE_MIN_SIZE) {
+            deflate_send_chunk(&deflate, http_request, true, s, len);
+            deflate_send_chunk(&deflate, http_request, false, NULL, 0);
         } else
-            hal.stream.write(ASCII_EOL);
+            httpd_resp_sendstr(http_request, s);
+    } else {
+        size_t len = strlen(s);
+        if(len && s[len - 1] == '\n')
+            write_n(s, len - 1); // drop LF, replaced by ASCII_EOL below
+        else
+            hal.stream.write(s);
+        hal.stream.write(ASCII_EOL);
     }
 }
 
@@ -168,9 +184,31 @@ void webui_print_is_json (void)
 void webui_print_flush (void)
 {
     if(http_request) {
-        if(chunked)
-            httpd_resp_sendstr_chunk(http_request, NULL);
+        if(deflate || chunked)
+            deflate_send_chunk(&deflate, http_request, false, NULL, 0);
     }
 }
 
+// JSON writer sink, output is sent as response chunks or written to the stream as is.
+bool webui_json_sink (void *ctx, const char *data, size_t length)
+{
+    if(data == NULL) { // end of document
+        if(http_request)
+            webui_print_flush();
+        else
+            hal.stream.write(ASCII_EOL);
+        return true;
+    }
+
+    if(http_request) {
+        bool first = !chunked;
+        chunked = true;
+        return deflate_send_chunk(&deflate, http_request, first, data, length);
+    }
+
+    hal.stream.write(data);
+
+    return true;
+}
+
 #endif
@@ -24,6 +24,9 @@
 #ifndef __WEBUI_RESPONSE_H__
 #define __WEBUI_RESPONSE_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include <esp_http_server.h>
 
 void webui_init (void);
@@ -32,6 +35,7 @@ void webui_print_chunk (const char *s);
 void webui_print_flush (void);
 void webui_print_is_json (void);
 void webui_set_http_request (httpd_req_t *req);
+bool webui_json_sink (void *ctx, const char *data, size_t length);
 
 #endif
 
@@ -42,14 +42,27 @@
 #include "networking/utils.h"
 #include "networking/strutils.h"
 #include "networking/http_upload.h"
+#include "web/json_writer.h"
+#include "grbl/nuts_bolts.h"
+#include "grbl/protocol.h"
+#include "grbl/report.h"
 
 #if SDCARD_ENABLE
 #include "sdcard/sdcard.h"
 #include "esp_vfs_fat.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
 #endif
 
 #if WEBUI_AUTH_ENABLE
-static webui_auth_t *sessions = NULL;
+#define WEBUI_SESSIONS_MAX      16      // must be a power of 2
+#define WEBUI_SESSION_TIMEOUT   360000  // ticks
+
+// Open addressed hash table keyed by session id. A slot with an empty id has never been used and ends
+// a probe, released or expired slots keep their id with level set to WebUIAuth_None so that later
+// entries in the probe sequence stay reachable.
+static webui_auth_t sessions[WEBUI_SESSIONS_MAX] = {0};
 static webui_auth_level_t get_auth_level (httpd_req_t *req);
 #endif
 
@@ -68,23 +81,187 @@ bool is_authorized (httpd_req_t *req, webui_auth_level_t min_level)
     return true;
 }
 
-esp_err_t webui_http_command_handler (httpd_req_t *req)
+#define COMMAND_CHUNK_SIZE  512
+#define COMMAND_FORM_MAX    4096    // max size of form encoded bodies, these are buffered
+#define COMMAND_BLOCK_MAX   16384   // max size of plain text bodies, these are buffered
+#define COMMAND_PUT_TIMEOUT 30000   // ms, max time the command task waits for room in the input buffer
+
+// G-code is passed on line by line. The first two characters of a line are held back until the line is
+// known to be longer, a line of a single character (a realtime command) is sent without a terminating LF.
+typedef struct {
+    size_t length;
+    bool wait;              // wait for room in the input buffer, only set by the command task
+    bool failed;
+    char head[2];
+} command_line_t;
+
+// G-code blocks are fed to the input buffer by a task so that the server task is not held up while the
+// controller consumes them. One block is handled at a time, busy is cleared by the task when it is done.
+static struct {
+    TaskHandle_t task;
+    volatile bool busy;
+    char *data;
+    size_t length;
+} command_block = {0};
+
+// Fails at once if the input buffer is full unless waiting is enabled, then it gives up if no
+// progress is made within COMMAND_PUT_TIMEOUT. The rest of the block is discarded on failure.
+static bool command_putc (command_line_t *line, char c)
+{
+    bool waiting = false;
+    TickType_t start = 0;
+
+    while(!line->failed && !websocketd_RxPutC(c)) {
+        if(!line->wait)
+            line->failed = true;
+        else if(!waiting) {
+            waiting = true;
+            start = xTaskGetTickCount();
+        } else if(xTaskGetTickCount() - start > pdMS_TO_TICKS(COMMAND_PUT_TIMEOUT))
+            line->failed = true;
+        else
+            vTaskDelay(1);
+    }
+
+    return !line->failed;
+}
+
+static bool command_line_end (command_line_t *line)
+{
+    if(line->length == 2 && (uint8_t)line->head[0] == 0xC2) // UTF-8 encoded top bit set realtime command
+        command_putc(line, line->head[1]);
+
+    else {
+
+        if(line->length == 1 || line->length == 2) {
+            command_putc(line, line->head[0]);
+            if(line->length == 2)
+                command_putc(line, line->head[1]);
+        }
+
+        if(line->length > 1)
+            command_putc(line, ASCII_LF);
+    }
+
+    line->length = 0;
+
+    return !line->failed;
+}
+
+static bool command_line_put (command_line_t *line, const char *data, size_t length)
+{
+    char c;
+
+    while(length-- && !line->failed) {
+
+        if((c = *data++) == '\n')
+            command_line_end(line);
+
+        else if(line->length < 2)
+            line->head[line->length++] = c;
+
+        else {
+            if(line->length == 2) {
+                command_putc(line, line->head[0]);
+                command_putc(line, line->head[1]);
+            }
+            command_putc(line, c);
+            line->length++;
+        }
+    }
+
+    return !line->failed;
+}
+
+static void command_send_status (httpd_req_t *req, const char *status, const char *msg)
+{
+    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+    httpd_resp_set_status(req, status);
+    httpd_resp_sendstr(req, msg);
+}
+
+static void command_block_failed (sys_state_t state)
+{
+    report_message("Input buffer full, rest of command block discarded", Message_Warning);
+}
+
+static void command_task (void *arg)
+{
+    command_line_t line;
+
+    while(true) {
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        memset(&line, 0, sizeof(command_line_t));
+        line.wait = true;
+
+        command_line_put(&line, command_block.data, command_block.length);
+        if(!command_line_end(&line))
+            protocol_enqueue_rt_command(command_block_failed);
+
+        free(command_block.data);
+        command_block.data = NULL;
+        command_block.busy = false;
+    }
+}
+
+// Hands a block allocated with malloc() over to the command task, the task frees it when done.
+// Returns false if the task is busy with the previous block or cannot be started, data is not freed then.
+static bool command_block_submit (char *data, size_t length)
+{
+    if(command_block.busy)
+        return false;
+
+    if(command_block.task == NULL && xTaskCreate(command_task, "command", 2048, NULL, uxTaskPriorityGet(NULL), &command_block.task) != pdPASS) {
+        command_block.task = NULL;
+        return false;
+    }
+
+    command_block.data = data;
+    command_block.length = length;
+    command_block.busy = true;
+
+    xTaskNotifyGive(command_block.task);
+
+    return true;
+}
+
+// Realtime commands are added to the input buffer right away, other g-code is copied and handed to the command task.
+// The response is sent when the block has been accepted, output from the controller arrives on the stream.
+static bool command_gcode (httpd_req_t *req, const char *data, size_t length)
 {
     bool ok;
-    char data[100], *cmd, *query = NULL;
-    size_t qlen = httpd_req_get_url_query_len(req);
+    char *block;
 
-    if(qlen && (query = malloc(qlen + 1))) {
+    if(length == 1 || (length == 2 && (uint8_t)*data == 0xC2)) {
 
-        httpd_req_get_url_query_str(req, query, qlen);
+        command_line_t line = {0};
 
-        if(http_get_key_value(query, "commandText", data, sizeof(data)) == NULL)
-            http_get_key_value(query, "plain", data, sizeof(data));
+        command_line_put(&line, data, length);
 
-        free(query);
+        if(!(ok = command_line_end(&line)))
+            command_send_status(req, "503 Service Unavailable", "Input buffer full\n");
 
-    } else
-        *data = '\0';
+    } else if(command_block.busy) {
+        ok = false;
+        command_send_status(req, "503 Service Unavailable", "Busy with the previous command block\n");
+    } else if(!(ok = (block = malloc(length)) != NULL && command_block_submit(memcpy(block, data, length), length))) {
+        if(block)
+            free(block);
+        httpd_resp_send_500(req);
+    }
+
+    if(ok)
+        httpd_resp_send(req, NULL, 0);
+
+    return ok;
+}
+
+static bool command_execute (httpd_req_t *req, char *data)
+{
+    bool ok;
+    char *cmd;
 
     if((ok = (*data != '\0'))) {
 
@@ -111,64 +288,304 @@ esp_err_t webui_http_command_handler (httpd_req_t *req)
 //          if(!is_authorized(req, WebUIAuth_User))
 //              return ESP_OK;
 
-            if(strlen(data) == 1)
-                websocketd_RxPutC(*data);
+            command_gcode(req, data, strlen(data));
+        }
+    }
+
+    return ok;
+}
+
+// Plain text POST bodies too large for a single chunk are assumed to be g-code, they are buffered and handed
+// to the command task. [ESP commands must fit in a single chunk.
+static bool command_post (httpd_req_t *req)
+{
+    int ret;
+    size_t received = 0, length = req->content_len;
+    char *data = NULL, chunk[COMMAND_CHUNK_SIZE + 1];
 
-            else {
+    if((ret = httpd_req_recv(req, chunk, min(length, COMMAND_CHUNK_SIZE))) <= 0) {
+        if(ret == HTTPD_SOCK_ERR_TIMEOUT)
+            httpd_resp_send_408(req);
+        return false;
+    }
 
-                size_t len;
-                char c, *block = strtok(data, "\n");
+    chunk[ret] = '\0';
 
-                while(block) {
+    if((size_t)ret == length)
+        return command_execute(req, chunk);
 
-                    if((len = strlen(block)) == 2 && *block == 0xC2) {
-                        block++;
-                        len--;
-                    }
+    if(strstr(chunk, "[ESP") || length > COMMAND_BLOCK_MAX) {
+        command_send_status(req, "413 Payload Too Large", strstr(chunk, "[ESP") ? "Command too long\n" : "Command block too large\n");
+        return false;
+    }
+
+    if(command_block.busy) {
+        command_send_status(req, "503 Service Unavailable", "Busy with the previous command block\n");
+        return false;
+    }
+
+    if((data = malloc(length)) == NULL) {
+        httpd_resp_send_500(req);
+        return false;
+    }
+
+    memcpy(data, chunk, ret);
+    received = (size_t)ret;
+
+    while(received < length) {
+        if((ret = httpd_req_recv(req, data + received, length - received)) <= 0) {
+            if(ret == HTTPD_SOCK_ERR_TIMEOUT)
+                httpd_resp_send_408(req);
+            free(data);
+            return false;
+        }
+        received += (size_t)ret;
+    }
 
-                    while((c = *block++))
-                        websocketd_RxPutC(c);
+    hal.stream.state.webui_connected = On;
 
-                    if(len > 1)
-                        websocketd_RxPutC(ASCII_LF);
+    if(!command_block_submit(data, length)) {
+        free(data);
+        httpd_resp_send_500(req);
+        return false;
+    }
+
+    httpd_resp_send(req, NULL, 0);
+
+    return true;
+}
+
+// Commands are accepted in the commandText or plain query parameter (GET) or in the request body (POST),
+// either form encoded with the same parameter names or as plain text. Multi line blocks may be of any size.
+esp_err_t webui_http_command_handler (httpd_req_t *req)
+{
+    bool ok = false;
+    char *query = NULL, *data = NULL;
+    size_t qlen = req->method == HTTP_POST ? req->content_len : httpd_req_get_url_query_len(req);
+
+    if(req->method == HTTP_POST) {
+
+        char type[40] = "";
 
-                    block = strtok(NULL, "\n");
+        httpd_req_get_hdr_value_str(req, "Content-Type", type, sizeof(type));
+
+        if(strncmp(type, "application/x-www-form-urlencoded", 33))
+            return command_post(req) ? ESP_OK : ESP_FAIL;
+
+        if(qlen > COMMAND_FORM_MAX) {
+            command_send_status(req, "413 Payload Too Large", "Use a plain text body for large blocks\n");
+            return ESP_FAIL;
+        }
+    }
+
+    if(qlen && (query = malloc(qlen + 1)) && (data = malloc(qlen + 1))) {
+
+        *data = '\0';
+
+        if(req->method == HTTP_POST) {
+
+            int ret;
+            size_t received = 0;
+
+            while(received < qlen) {
+                if((ret = httpd_req_recv(req, query + received, qlen - received)) <= 0) {
+                    if(ret == HTTPD_SOCK_ERR_TIMEOUT)
+                        httpd_resp_send_408(req);
+                    break;
                 }
+                received += (size_t)ret;
             }
+            query[received] = '\0';
 
-            httpd_resp_send(req, NULL, 0);
-        }
+            if(received < qlen)
+                *query = '\0';
+        } else
+            httpd_req_get_url_query_str(req, query, qlen + 1);
+
+        if(http_get_key_value(query, "commandText", data, qlen + 1) == NULL)
+            http_get_key_value(query, "plain", data, qlen + 1);
+
+        ok = command_execute(req, data);
     }
 
+    if(query)
+        free(query);
+    if(data)
+        free(data);
+
     return ok ? ESP_OK : ESP_FAIL;
 }
 
 #if SDCARD_ENABLE
 
+#define SD_LS_CACHE_SIZE    4       // number of directory listings cached
+#define SD_LS_CACHE_MAX     8192    // max size of packed entries, larger directories are not cached
+#define SD_LS_PATH_MAX      64      // listings of directories with longer paths are not cached
+
+// Packed entry: attributes, size and NUL terminated name.
+#define SD_LS_ENTRY_HDR     (sizeof(BYTE) + sizeof(DWORD))
+
+// Listings and free space are valid until the card is remounted (the FATFS mount id changes)
+// or the web server modifies the card (the path cache generation changes).
+typedef struct {
+    WORD fs_id;
+    uint32_t generation;
+    uint32_t last_used;
+    size_t length;
+    char *entries;
+    char path[SD_LS_PATH_MAX];
+} sd_listing_t;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t size;
+    bool overflow;
+} sd_capture_t;
+
+static sd_listing_t sd_listing[SD_LS_CACHE_SIZE] = {0};
+static uint32_t sd_listing_clock = 0;
+
+static struct {
+    WORD fs_id;
+    uint32_t generation;
+    DWORD tot_sect;
+    DWORD used_sect;
+} sd_space = {0};
+
 // add file to the JSON response array
-static bool add_file (cJSON *files, char *path, FILINFO *file)
+static bool add_file (json_writer_t *json, const char *name, BYTE attrib, DWORD size)
 {
-    bool ok;
+    json_start_object(json, NULL);
+    json_add_string(json, "name", name);
+    json_add_string(json, "shortname", name);
+    json_add_string(json, "datetime", "");
+    if(attrib & AM_DIR)
+        json_add_int(json, "size", -1);
+    else
+        json_add_string(json, "size", btoa(size));
+    json_end_object(json);
+
+    return json->ok;
+}
 
-    cJSON *fileinfo;
+// Append entry to the capture buffer, capturing is abandoned if the listing grows too large.
+static void sd_capture_file (sd_capture_t *capture, FILINFO *file)
+{
+    if(capture->overflow)
+        return;
 
-    if((ok = (fileinfo = cJSON_CreateObject()) != NULL))
-    {
-        ok = cJSON_AddStringToObject(fileinfo, "name", file->fname) != NULL;
-        ok &= cJSON_AddStringToObject(fileinfo, "shortname", file->fname) != NULL;
-        ok &= cJSON_AddStringToObject(fileinfo, "datetime", "") != NULL;
-        if(file->fattrib & AM_DIR)
-            ok &= cJSON_AddNumberToObject(fileinfo, "size", -1.0f) != NULL;
-        else
-            ok &= cJSON_AddStringToObject(fileinfo, "size", btoa(file->fsize)) != NULL;
-        if(ok)
-            cJSON_AddItemToArray(files, fileinfo);
+    DWORD size = file->fsize;
+    size_t len = SD_LS_ENTRY_HDR + strlen(file->fname) + 1;
+
+    if(capture->length + len > capture->size) {
+
+        char *data;
+        size_t size = capture->size ? capture->size : 1024;
+
+        while(size < capture->length + len)
+            size <<= 1;
+
+        if(size > SD_LS_CACHE_MAX || (data = realloc(capture->data, size)) == NULL) {
+            capture->overflow = true;
+            return;
+        }
+
+        capture->data = data;
+        capture->size = size;
     }
 
-    return ok;
+    char *entry = capture->data + capture->length;
+
+    *entry = file->fattrib;
+    memcpy(entry + sizeof(BYTE), &size, sizeof(DWORD));
+    strcpy(entry + SD_LS_ENTRY_HDR, file->fname);
+
+    capture->length += len;
+}
+
+// Mount id of the volume holding path, 0 if path cannot be opened.
+static WORD sd_mount_id (char *path)
+{
+#if defined(ESP_PLATFORM)
+    FF_DIR dir;
+#else
+    DIR dir;
+#endif
+    WORD id = 0;
+
+    if(f_opendir(&dir, path) == FR_OK) {
+        id = dir.obj.id;
+        f_closedir(&dir);
+    }
+
+    return id;
+}
+
+static sd_listing_t *sd_listing_get (char *path, WORD fs_id)
+{
+    uint32_t generation = http_path_cache_generation();
+    uint_fast8_t idx = SD_LS_CACHE_SIZE;
+
+    do {
+        sd_listing_t *listing = &sd_listing[--idx];
+        if(listing->entries && listing->fs_id == fs_id && listing->generation == generation && !strcmp(listing->path, path)) {
+            listing->last_used = ++sd_listing_clock;
+            return listing;
+        }
+    } while(idx);
+
+    return NULL;
+}
+
+// Takes ownership of the captured data, the least recently used or an invalid listing is replaced.
+static void sd_listing_put (char *path, WORD fs_id, sd_capture_t *capture)
+{
+    if(capture->overflow || strlen(path) >= SD_LS_PATH_MAX) {
+        if(capture->data)
+            free(capture->data);
+        return;
+    }
+
+    uint32_t generation = http_path_cache_generation();
+    uint_fast8_t idx = SD_LS_CACHE_SIZE;
+    sd_listing_t *listing, *victim = &sd_listing[0];
+
+    do {
+        listing = &sd_listing[--idx];
+        if(listing->entries == NULL || listing->fs_id != fs_id || listing->generation != generation) {
+            victim = listing;
+            break;
+        }
+        if(listing->last_used < victim->last_used)
+            victim = listing;
+    } while(idx);
+
+    if(victim->entries)
+        free(victim->entries);
+
+    strcpy(victim->path, path);
+    victim->fs_id = fs_id;
+    victim->generation = generation;
+    victim->last_used = ++sd_listing_clock;
+    victim->length = capture->length;
+    victim->entries = capture->data ? capture->data : malloc(1); // empty directory
 }
 
-static FRESULT sd_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
+static void sd_listing_replay (json_writer_t *json, sd_listing_t *listing)
+{
+    DWORD size;
+    char *entry = listing->entries, *end = listing->entries + listing->length;
+
+    while(entry < end) {
+        memcpy(&size, entry + sizeof(BYTE), sizeof(DWORD));
+        add_file(json, entry + SD_LS_ENTRY_HDR, (BYTE)*entry, size);
+        entry += SD_LS_ENTRY_HDR + strlen(entry + SD_LS_ENTRY_HDR) + 1;
+    }
+}
+
+// Single pass, entries are reported in directory order. Top level entries are captured if capture is not NULL.
+static FRESULT sd_scan_dir (json_writer_t *json, char *path, uint_fast8_t depth, sd_capture_t *capture)
 {
 #if defined(ESP_PLATFORM)
     FF_DIR dir;
@@ -177,7 +594,6 @@ static FRESULT sd_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
 #endif
     FILINFO fno;
     FRESULT res;
-    bool subdirs = false;
 #if _USE_LFN
     static TCHAR lfn[_MAX_LFN + 1];   /* Buffer to store the LFN */
     fno.lfname = lfn;
@@ -187,39 +603,32 @@ static FRESULT sd_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
    if((res = f_opendir(&dir, path)) != FR_OK)
         return res;
 
-   // Pass 1: Scan files
     while(true) {
 
         if((res = f_readdir(&dir, &fno)) != FR_OK || fno.fname[0] == '\0')
             break;
 
-        subdirs |= fno.fattrib & AM_DIR;
-
-        if(!(fno.fattrib & AM_DIR))
-            add_file(files, path, &fno);
-    }
-
-    if((subdirs = (subdirs && depth)))
-        f_readdir(&dir, NULL); // Rewind
+        if(fno.fattrib & AM_DIR) {
 
-    // Pass 2: Scan directories
-    while(subdirs) {
+            if(!depth || !strcmp(fno.fname, "System Volume Information"))
+                continue;
 
-        if((res = f_readdir(&dir, &fno)) != FR_OK || *fno.fname == '\0')
-            break;
-
-        if((fno.fattrib & AM_DIR) && strcmp(fno.fname, "System Volume Information")) {
+            add_file(json, fno.fname, fno.fattrib, 0);
+            if(capture)
+                sd_capture_file(capture, &fno);
 
-            size_t pathlen = strlen(path);
-//          if(pathlen + strlen(get_name(&fno)) > (MAX_PATHLEN - 1))
-                //break;
-            add_file(files, path, &fno);
             if(depth > 1) {
+                size_t pathlen = strlen(path);
                 sprintf(&path[pathlen], "/%s", fno.fname);
-                if((res = sd_scan_dir(files, path, depth - 1)) != FR_OK)
-                    break;
+                res = sd_scan_dir(json, path, depth - 1, NULL);
                 path[pathlen] = '\0';
+                if(res != FR_OK)
+                    break;
             }
+        } else {
+            add_file(json, fno.fname, fno.fattrib, fno.fsize);
+            if(capture)
+                sd_capture_file(capture, &fno);
         }
     }
 
@@ -230,47 +639,108 @@ static FRESULT sd_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
     return res;
 }
 
+// f_getfree() may scan the whole FAT on large cards, the result is kept until the card is changed.
+static bool sd_get_space (WORD fs_id, DWORD *tot_sect, DWORD *used_sect)
+{
+    uint32_t generation = http_path_cache_generation();
+
+    if(!(fs_id && sd_space.fs_id == fs_id && sd_space.generation == generation)) {
+
+        FATFS *fs;
+        DWORD fre_clust;
+
+        if(f_getfree("", &fre_clust, &fs) != FR_OK)
+            return false;
+
+        sd_space.fs_id = fs->id;
+        sd_space.generation = generation;
+        sd_space.tot_sect = (fs->n_fatent - 2) * fs->csize;
+        sd_space.used_sect = sd_space.tot_sect - fre_clust * fs->csize;
+    }
+
+    *tot_sect = sd_space.tot_sect;
+    *used_sect = sd_space.used_sect;
+
+    return true;
+}
+
+// Completes a directory listing, returns false if it failed. The error response is sent if nothing has been
+// sent yet, otherwise the chunked response cannot be turned into an error and the caller must return ESP_FAIL
+// to make the server close the session.
+static bool ls_end (httpd_req_t *req, json_writer_t *json, bool ok)
+{
+    if(!ok)
+        json_writer_abort(json);
+    else if(json_writer_end(json))
+        return true;
+
+    if(!json_writer_started(json))
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to generate response");
+
+    return false;
+}
+
+// btoa() takes a size_t, cards larger than 4 GB need 64 bits.
+static char *sd_btoa (uint64_t bytes)
+{
+    static char val[20];
+
+    if(bytes <= (uint64_t)SIZE_MAX)
+        return btoa((size_t)bytes);
+
+    sprintf(val, "%.2f GB", (double)bytes / (1024.0 * 1024.0 * 1024.0));
+
+    return val;
+}
+
+// The listing is streamed as it is scanned, memory use does not depend on the number of files.
+// Listings of directories with few entries are cached and replayed without accessing the card.
 static bool sd_ls (httpd_req_t *req, char *path, char *status)
 {
     bool ok;
-    cJSON *root = cJSON_CreateObject(), *files = NULL;
+    json_writer_t writer, *json = &writer;
 
-    if((ok = (root && (files = cJSON_AddArrayToObject(root, "files"))))) {
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    json_writer_init_http(json, req);
 
-        if(strlen(path) > 1)
-            path[strlen(path) - 1] = '\0';
+    json_start_object(json, NULL);
+    json_start_array(json, "files");
 
-        sd_scan_dir(files, path, 1);
+    if(strlen(path) > 1)
+        path[strlen(path) - 1] = '\0';
 
-        cJSON_AddStringToObject(root, "path", path);
+    sd_listing_t *listing;
+    WORD fs_id = sd_mount_id(path);
 
-        FATFS *fs;
-        DWORD fre_clust, used_sect, tot_sect;
-
-        if(f_getfree("", &fre_clust, &fs) == FR_OK) {
-            tot_sect = (fs->n_fatent - 2) * fs->csize;
-            used_sect = tot_sect - fre_clust * fs->csize;
-            uint32_t pct_used = (used_sect * 100) / tot_sect;
-            cJSON_AddStringToObject(root, "total", btoa(tot_sect << 9)); // assuming 512 byte sector size
-            cJSON_AddStringToObject(root, "used", btoa(used_sect << 9));
-            cJSON_AddStringToObject(root, "occupation", uitoa(pct_used == 0 ? 1 : pct_used));
-        }
-        cJSON_AddStringToObject(root, "mode", "direct");
-        cJSON_AddStringToObject(root, "status", status);
+    if(!(ok = fs_id != 0)) // path cannot be opened
+        return ls_end(req, json, ok);
 
-        char *resp = cJSON_PrintUnformatted(root);
+    if((listing = sd_listing_get(path, fs_id)))
+        sd_listing_replay(json, listing);
+    else {
+        sd_capture_t capture = {0};
+        if((ok = sd_scan_dir(json, path, 1, &capture) == FR_OK))
+            sd_listing_put(path, fs_id, &capture);
+        else if(capture.data)
+            free(capture.data);
+    }
 
-        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
-        httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-        httpd_resp_send(req, resp, strlen(resp));
+    json_end_array(json);
+    json_add_string(json, "path", path);
 
-        free(resp);
-    }
+    DWORD used_sect, tot_sect;
 
-    if(root)
-        cJSON_Delete(root);
+    if(sd_get_space(fs_id, &tot_sect, &used_sect)) {
+        uint32_t pct_used = (used_sect * 100ULL) / tot_sect;
+        json_add_string(json, "total", sd_btoa((uint64_t)tot_sect << 9)); // assuming 512 byte sector size
+        json_add_string(json, "used", sd_btoa((uint64_t)used_sect << 9));
+        json_add_string(json, "occupation", uitoa(pct_used == 0 ? 1 : pct_used));
+    }
+    json_add_string(json, "mode", "direct");
+    json_add_string(json, "status", status);
+    json_end_object(json);
 
-    return ok;
+    return ls_end(req, json, ok);
 }
 
 static bool sd_rmdir (char *path)
@@ -356,6 +826,7 @@ esp_err_t webui_sdcard_handler (httpd_req_t *req)
                             sprintf(status, "Cannot delete %s!", filename);
                     } else
                         sprintf(status, "%s does not exist!", filename);
+                    http_path_cache_invalidate();
                     break;
 
                 case 1: // createdir
@@ -366,6 +837,7 @@ esp_err_t webui_sdcard_handler (httpd_req_t *req)
                             sprintf(status, "Cannot create %s!", filename);
                     } else
                         sprintf(status, "%s already exists!", filename);
+                    http_path_cache_invalidate();
                     break;
 
                 case 2: // deletedir
@@ -378,6 +850,7 @@ esp_err_t webui_sdcard_handler (httpd_req_t *req)
                             sprintf(status, "Error deleting %s!", filename);
                     } else
                         sprintf(status, "%s does not exist!", filename);
+                    http_path_cache_invalidate();
                     break;
 
                 default:
@@ -390,8 +863,7 @@ esp_err_t webui_sdcard_handler (httpd_req_t *req)
     if(*path == '\0')
         strcpy(path, "/");
 
-    if(!(ok = sd_ls(req, path, status)))
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to generate response");
+    ok = sd_ls(req, path, status);
 
     if(query)
         free(query);
@@ -399,10 +871,166 @@ esp_err_t webui_sdcard_handler (httpd_req_t *req)
     return ok ? ESP_OK : ESP_FAIL;
 }
 
-esp_err_t webui_sdcard_upload_handler (httpd_req_t *req)
+#define UPLOAD_BUFFERS      3
+#define UPLOAD_BUFFER_SIZE  (8 * 1024)
+
+typedef struct {
+    char *data;
+    size_t length;          // 0 signals end of upload to the writer task
+} upload_buffer_t;
+
+typedef struct {
+    httpd_req_t *req;
+    char *path;
+    QueueHandle_t free;
+    QueueHandle_t filled;
+    SemaphoreHandle_t done;
+    upload_buffer_t buffer[UPLOAD_BUFFERS];
+} upload_pipeline_t;
+
+// Writes received data to the card while the next chunk is received by the server task.
+static void upload_writer (void *arg)
+{
+    upload_buffer_t *buffer;
+    upload_pipeline_t *pipeline = (upload_pipeline_t *)arg;
+    file_upload_t *upload = (file_upload_t *)pipeline->req->sess_ctx;
+
+    while(xQueueReceive(pipeline->filled, &buffer, portMAX_DELAY) == pdTRUE && buffer->length) {
+
+        http_upload_chunk(pipeline->req, buffer->data, buffer->length);
+
+        if(*pipeline->path == '\0' && *upload->path)
+            strcpy(pipeline->path, upload->path);
+
+        xQueueSend(pipeline->free, &buffer, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(pipeline->done);
+    vTaskDelete(NULL);
+}
+
+static void upload_pipeline_free (upload_pipeline_t *pipeline)
+{
+    uint_fast8_t idx = UPLOAD_BUFFERS;
+
+    do {
+        if(pipeline->buffer[--idx].data)
+            heap_caps_free(pipeline->buffer[idx].data);
+    } while(idx);
+
+    if(pipeline->free)
+        vQueueDelete(pipeline->free);
+    if(pipeline->filled)
+        vQueueDelete(pipeline->filled);
+    if(pipeline->done)
+        vSemaphoreDelete(pipeline->done);
+
+    free(pipeline);
+}
+
+static upload_pipeline_t *upload_pipeline_create (httpd_req_t *req, char *path)
+{
+    upload_pipeline_t *pipeline;
+
+    if((pipeline = calloc(sizeof(upload_pipeline_t), 1)) == NULL)
+        return NULL;
+
+    pipeline->req = req;
+    pipeline->path = path;
+
+    bool ok = (pipeline->free = xQueueCreate(UPLOAD_BUFFERS, sizeof(upload_buffer_t *))) &&
+               (pipeline->filled = xQueueCreate(UPLOAD_BUFFERS + 1, sizeof(upload_buffer_t *))) &&
+                (pipeline->done = xSemaphoreCreateBinary());
+
+    if(ok) {
+        uint_fast8_t idx = UPLOAD_BUFFERS;
+        do {
+            upload_buffer_t *buffer = &pipeline->buffer[--idx];
+            if((ok = !!(buffer->data = heap_caps_malloc(UPLOAD_BUFFER_SIZE, MALLOC_CAP_DMA))))
+                xQueueSend(pipeline->free, &buffer, 0);
+        } while(ok && idx);
+    }
+
+    if(ok)
+        ok = xTaskCreate(upload_writer, "upload", 4096, pipeline, uxTaskPriorityGet(NULL), NULL) == pdPASS;
+
+    if(!ok) {
+        upload_pipeline_free(pipeline);
+        pipeline = NULL;
+    }
+
+    return pipeline;
+}
+
+// Receives the request body into one buffer while the writer task writes the previous ones to the card.
+// Falls back to receiving and writing in turn via the scratch buffer if the pipeline cannot be set up.
+static bool upload_receive (httpd_req_t *req, char *path)
 {
-    bool ok = false;
     int ret;
+    bool ok = true;
+    size_t remaining = req->content_len;
+    upload_buffer_t *buffer, end = {0}, *last = &end;
+    upload_pipeline_t *pipeline;
+    file_upload_t *upload = (file_upload_t *)req->sess_ctx;
+
+    if((pipeline = upload_pipeline_create(req, path)) == NULL) {
+
+        char *scratch = ((file_server_data_t *)req->user_ctx)->scratch;
+
+        do {
+
+            if((ret = httpd_req_recv(req, scratch, sizeof(fs_scratch_t))) <= 0) {
+                if(ret == HTTPD_SOCK_ERR_TIMEOUT)
+                    httpd_resp_send_408(req);
+                return false;
+            }
+
+            http_upload_chunk(req, scratch, (size_t)ret);
+
+            if(*path == '\0' && *upload->path)
+                strcpy(path, upload->path);
+
+        } while(upload->state != Upload_Complete);
+
+        return true;
+    }
+
+    while(remaining) {
+
+        xQueueReceive(pipeline->free, &buffer, portMAX_DELAY);
+
+        if((ret = httpd_req_recv(req, buffer->data, min(remaining, UPLOAD_BUFFER_SIZE))) <= 0) {
+            ok = false;
+            if(ret == HTTPD_SOCK_ERR_TIMEOUT)
+                httpd_resp_send_408(req);
+            break;
+        }
+
+        buffer->length = (size_t)ret;
+        remaining -= buffer->length;
+
+        xQueueSend(pipeline->filled, &buffer, portMAX_DELAY);
+    }
+
+    xQueueSend(pipeline->filled, &last, portMAX_DELAY);
+    xSemaphoreTake(pipeline->done, portMAX_DELAY);
+
+    upload_pipeline_free(pipeline);
+
+    return ok && upload->state == Upload_Complete;
+}
+
+static char upload_msg[40];
+
+// Runs in the foreground, the stream must not be written to from the http server task.
+static void upload_report (sys_state_t state)
+{
+    report_message(upload_msg, Message_Plain);
+}
+
+esp_err_t webui_sdcard_upload_handler (httpd_req_t *req)
+{
+    bool ok = false, listed = false;
 
     if(!is_authorized(req, WebUIAuth_User))
         return ESP_OK;
@@ -421,44 +1049,41 @@ esp_err_t webui_sdcard_upload_handler (httpd_req_t *req)
     }
 
     fs_path_t path;
-    char *scratch = ((file_server_data_t *)req->user_ctx)->scratch;
-    file_upload_t *upload = (file_upload_t *)req->sess_ctx;
+    int64_t started = esp_timer_get_time();
 
     *path = '\0';
 
-    if (ok) do { // Process received data
-
-        if ((ret = httpd_req_recv(req, scratch, sizeof(fs_scratch_t))) <= 0) {
-            ok = false;
-            if (ret == HTTPD_SOCK_ERR_TIMEOUT)
-                httpd_resp_send_408(req);
-            break;
-        }
-
-        http_upload_chunk(req, scratch, (size_t)ret);
+    if(ok)
+        ok = upload_receive(req, path);
 
-        if(*path == '\0' && *upload->path)
-            strcpy(path, upload->path);
+    int64_t elapsed = esp_timer_get_time() - started;
 
-    } while(upload->state != Upload_Complete);
+    http_path_cache_invalidate();
 
     if(*path == '\0') // in case something failed...
         strcpy(path, "/");
 
-    if(!(ok && sd_ls(req, path, "ok")))
-        httpd_resp_send_err(req, 400, "Upload failed"); // or did it?
+    if(ok)
+        listed = sd_ls(req, path, "ok"); // sends the error response itself if the listing fails
+    else
+        httpd_resp_send_err(req, 400, "Upload failed");
 
     if(req->sess_ctx && req->free_ctx) {
         req->free_ctx(req->sess_ctx);
         req->sess_ctx = NULL;
     }
 
-    hal.stream.write(ok ? "[MSG:Upload ok]\r\n" : "[MSG:Upload failed]\r\n");
+    if(ok) // bytes per microsecond equals megabytes per second
+        sprintf(upload_msg, "Upload ok, %s MB/s", ftoa(elapsed > 0 ? (float)req->content_len / (float)elapsed : 0.0f, 2));
+    else
+        strcpy(upload_msg, "Upload failed");
+
+    protocol_enqueue_rt_command(upload_report);
 
     if(rqhdr)
         free(rqhdr);
 
-    return ok ? ESP_OK : ESP_FAIL;
+    return listed ? ESP_OK : ESP_FAIL;
 }
 
 static bool spiffs_isdirectory(char *filename)
@@ -466,26 +1091,20 @@ static bool spiffs_isdirectory(char *filename)
     return strrchr(filename, '/') && filename[strlen(filename) - 1] == '.';
 }
 
-static bool spiffs_add_file (cJSON *files, char *filename, struct stat *file)
+static bool spiffs_add_file (json_writer_t *json, char *filename, struct stat *file)
 {
-    bool ok;
-    cJSON *fileinfo;
-
-    if((ok = (fileinfo = cJSON_CreateObject()) != NULL))
-    {
-        ok = cJSON_AddStringToObject(fileinfo, "name", filename) != NULL;
-        if(S_ISDIR(file->st_mode))
-            ok &= cJSON_AddNumberToObject(fileinfo, "size", -1.0f) != NULL;
-        else
-            ok &= cJSON_AddStringToObject(fileinfo, "size", btoa(file->st_size)) != NULL;
-        if(ok)
-            cJSON_AddItemToArray(files, fileinfo);
-    }
+    json_start_object(json, NULL);
+    json_add_string(json, "name", filename);
+    if(S_ISDIR(file->st_mode))
+        json_add_int(json, "size", -1);
+    else
+        json_add_string(json, "size", btoa(file->st_size));
+    json_end_object(json);
 
-    return ok;
+    return json->ok;
 }
 
-static bool spiffs_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
+static bool spiffs_scan_dir (json_writer_t *json, char *path, uint_fast8_t depth)
 {
     DIR *dir;
     struct dirent *entry;
@@ -514,7 +1133,7 @@ static bool spiffs_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
                 fname++;
 
             if(fname - path == pathlen)
-                spiffs_add_file(files, fname, &file);
+                spiffs_add_file(json, fname, &file);
             if(path[pathlen - 1] == '\0')
                 path[pathlen - 1] = '/';
         }
@@ -530,42 +1149,35 @@ static bool spiffs_scan_dir (cJSON *files, char *path, uint_fast8_t depth)
 static bool spiffs_ls (httpd_req_t *req, char *path, char *status)
 {
     bool ok;
-    cJSON *root = cJSON_CreateObject(), *files = NULL;
-
-    if((ok = (root && (files = cJSON_AddArrayToObject(root, "files"))))) {
-
-        if(strlen(path) > 1)
-            path[strlen(path) - 1] = '\0';
+    json_writer_t writer, *json = &writer;
 
-        spiffs_scan_dir(files, path, 1);
-
-        cJSON_AddStringToObject(root, "path", path);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    json_writer_init_http(json, req);
 
-        size_t total = 0, used = 0;
+    json_start_object(json, NULL);
+    json_start_array(json, "files");
 
-        if(esp_spiffs_info(NULL, &total, &used) == ESP_OK) {
+    if(strlen(path) > 1)
+        path[strlen(path) - 1] = '\0';
 
-            uint32_t pct_used = (used * 100) / total;
-            cJSON_AddStringToObject(root, "total", btoa(total));
-            cJSON_AddStringToObject(root, "used", btoa(used));
-            cJSON_AddStringToObject(root, "occupation", uitoa(pct_used == 0 ? 1 : pct_used));
-        }
-        cJSON_AddStringToObject(root, "mode", "direct");
-        cJSON_AddStringToObject(root, "status", status);
+    ok = spiffs_scan_dir(json, path, 1);
 
-        char *resp = cJSON_PrintUnformatted(root);
+    json_end_array(json);
+    json_add_string(json, "path", path);
 
-        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
-        httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-        httpd_resp_send(req, resp, strlen(resp));
+    size_t total = 0, used = 0;
 
-        free(resp);
+    if(esp_spiffs_info(NULL, &total, &used) == ESP_OK) {
+        uint32_t pct_used = (used * 100) / total;
+        json_add_string(json, "total", btoa(total));
+        json_add_string(json, "used", btoa(used));
+        json_add_string(json, "occupation", uitoa(pct_used == 0 ? 1 : pct_used));
     }
+    json_add_string(json, "mode", "direct");
+    json_add_string(json, "status", status);
+    json_end_object(json);
 
-    if(root)
-        cJSON_Delete(root);
-
-    return ok;
+    return ls_end(req, json, ok);
 }
 
 static bool spiffs_rmdir (char *path)
@@ -642,6 +1254,7 @@ esp_err_t webui_spiffs_handler (httpd_req_t *req)
                             sprintf(status, "Cannot delete %s!", filename);
                     } else
                         sprintf(status, "%s does not exist!", filename);
+                    http_path_cache_invalidate();
                     break;
 
                 case 1: // createdir
@@ -655,6 +1268,7 @@ esp_err_t webui_spiffs_handler (httpd_req_t *req)
                             sprintf(status, "Cannot create %s!", filename);
                     } else
                         sprintf(status, "%s already exists!", filename);
+                    http_path_cache_invalidate();
                     break;
 
                 case 2: // deletedir
@@ -668,6 +1282,7 @@ esp_err_t webui_spiffs_handler (httpd_req_t *req)
                             sprintf(status, "Error deleting %s!", filename);
                     } else
                         sprintf(status, "%s does not exist!", filename);
+                    http_path_cache_invalidate();
                     break;
 
                 case 3: // list
@@ -688,8 +1303,7 @@ esp_err_t webui_spiffs_handler (httpd_req_t *req)
     if(*path == '\0')
         strcpy(path, "/spiffs/");
 
-    if(!(ok = spiffs_ls(req, path, status)))
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to generate response");
+    ok = spiffs_ls(req, path, status);
 
     if(query)
         free(query);
@@ -757,11 +1371,12 @@ esp_err_t webui_spiffs_upload_handler (httpd_req_t *req)
 
     } while(upload->state != Upload_Complete);
 
+    http_path_cache_invalidate();
+
     if(*path == '\0') // in case something failed...
-        strcpy(path, "/");
+        strcpy(path, "/spiffs/");
 
-    if(!(ok = spiffs_ls(req, path, "ok")))
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to generate response");
+    ok = spiffs_ls(req, path, "ok");
 
     if(req->sess_ctx && req->free_ctx) {
         req->free_ctx(req->sess_ctx);
@@ -789,37 +1404,6 @@ static struct sockaddr_in6 *get_ipaddress (httpd_req_t *req)
     return &addr;
 }
 
-static webui_auth_level_t check_authenticated (struct sockaddr_in6 *ip, const session_id_t *session_id)
-{
-    webui_auth_t *current = sessions, *previous = NULL;
-    TickType_t now = xTaskGetTickCount();
-
-    webui_auth_level_t level = WebUIAuth_Guest;
-
-    while(current) {
-        if(now - current->last_access > 360000) {
-            if(current == sessions) {
-                sessions = current->next;
-                free(current);
-                current = sessions;
-            } else {
-                previous->next = current->next;
-                free(current);
-                current = previous->next;
-            }
-        } else {
-            if (memcmp(ip, &current->ip, sizeof(struct sockaddr_in6)) == 0 && memcmp(session_id, current->session_id, sizeof(session_id_t)) == 0) {
-                current->last_access = now;
-                level = current->level;
-            }
-            previous = current;
-            current = current->next;
-        }
-    }
-
-    return level;
-}
-
 static session_id_t *create_session_id (struct sockaddr_in6 *ip)
 {
     static session_id_t session_id;
@@ -834,61 +1418,128 @@ static session_id_t *create_session_id (struct sockaddr_in6 *ip)
     return &session_id;
 }
 
-static session_id_t *get_session_id (httpd_req_t *req, session_id_t *session_id)
+static inline bool session_expired (webui_auth_t *session, TickType_t now)
+{
+    return now - session->last_access > WEBUI_SESSION_TIMEOUT;
+}
+
+static uint_fast8_t session_hash (const session_id_t *session_id)
+{
+    uint32_t hash = 2166136261UL; // FNV-1a
+    const char *id = *session_id;
+
+    while(*id)
+        hash = (hash ^ (uint8_t)*id++) * 16777619UL;
+
+    return hash & (WEBUI_SESSIONS_MAX - 1);
+}
+
+// Expired sessions met while probing are released.
+static webui_auth_t *session_find (const session_id_t *session_id)
 {
-    char *cookie = NULL, *token = NULL, *end = NULL;;
-    size_t len = httpd_req_get_hdr_value_len(req, "Cookie");
+    webui_auth_t *session;
+    TickType_t now = xTaskGetTickCount();
+    uint_fast8_t idx = session_hash(session_id), probes = WEBUI_SESSIONS_MAX;
 
-    if(len && (cookie = malloc(len + 1))) {
+    do {
+        session = &sessions[idx];
 
-        httpd_req_get_hdr_value_str(req, "Cookie", cookie, len + 1);
+        if(*session->session_id == '\0')
+            break;
 
-        if((token = strstr(cookie, COOKIEPREFIX))) {
-            token += strlen(COOKIEPREFIX);
-            if((end = strchr(token, ';')))
-                *end = '\0';
-            if(strlen(token) == sizeof(session_id_t) - 1)
-                strcpy((char *)session_id, token);
-            else
-                token = NULL;
+        if(session->level != WebUIAuth_None) {
+            if(session_expired(session, now))
+                session->level = WebUIAuth_None;
+            else if(!memcmp(session->session_id, session_id, sizeof(session_id_t)))
+                return session;
         }
 
-        free(cookie);
-    }
+        idx = (idx + 1) & (WEBUI_SESSIONS_MAX - 1);
+    } while(--probes);
 
-    return token ? session_id : NULL;
+    return NULL;
 }
 
-static bool unlink_session (httpd_req_t *req)
+// Claims the first free slot in the probe sequence, if there is none the least recently used session is dropped.
+static webui_auth_t *session_add (struct sockaddr_in6 *ip, webui_auth_level_t level, const char *user)
 {
-    bool ok = false;
-    session_id_t session_id;
+    session_id_t *session_id = create_session_id(ip);
+    webui_auth_t *session, *victim = NULL;
+    TickType_t now = xTaskGetTickCount();
+    uint_fast8_t idx = session_hash(session_id), probes = WEBUI_SESSIONS_MAX;
+
+    do {
+        session = &sessions[idx];
 
-    if(get_session_id(req, &session_id)) {
+        if(session->level == WebUIAuth_None || session_expired(session, now)) {
+            victim = session;
+            break;
+        }
 
-        webui_auth_t *current = sessions, *previous = NULL;
+        if(victim == NULL || now - session->last_access > now - victim->last_access)
+            victim = session;
 
-        while(current) {
+        idx = (idx + 1) & (WEBUI_SESSIONS_MAX - 1);
+    } while(--probes);
 
-            if(memcmp(session_id, current->session_id, sizeof(session_id_t)) == 0) {
-                ok = true;
-                if(current == sessions) {
-                    sessions = current->next;
-                    free(current);
-                    current = NULL;
-                } else {
-                    previous->next = current->next;
-                    free(current);
-                    current = NULL;
-                }
-            } else {
-                previous = current;
-                current = current->next;
-            }
-        }
+    memcpy(&victim->ip, ip, sizeof(struct sockaddr_in6));
+    memcpy(victim->session_id, session_id, sizeof(session_id_t));
+    strncpy(victim->user_id, user, sizeof(user_id_t) - 1);
+    victim->user_id[sizeof(user_id_t) - 1] = '\0';
+    victim->level = level;
+    victim->last_access = now;
+
+    return victim;
+}
+
+static webui_auth_level_t check_authenticated (struct sockaddr_in6 *ip, const session_id_t *session_id)
+{
+    webui_auth_t *session;
+    webui_auth_level_t level = WebUIAuth_Guest;
+
+    if((session = session_find(session_id)) && memcmp(ip, &session->ip, sizeof(struct sockaddr_in6)) == 0) {
+        session->last_access = xTaskGetTickCount();
+        level = session->level;
     }
 
-    return ok;
+    return level;
+}
+
+// The Cookie header is parsed in a stack buffer, it cannot be longer than the server accepts for a request header.
+static session_id_t *get_session_id (httpd_req_t *req, session_id_t *session_id)
+{
+    char cookie[CONFIG_HTTPD_MAX_REQ_HDR_LEN + 1], *token;
+    size_t len;
+
+    if(httpd_req_get_hdr_value_str(req, "Cookie", cookie, sizeof(cookie)) != ESP_OK)
+        return NULL;
+
+    for(token = cookie; (token = strstr(token, COOKIEPREFIX)); token += strlen(COOKIEPREFIX)) {
+        if(token == cookie || token[-1] == ' ' || token[-1] == ';')
+            break;
+    }
+
+    if(token) {
+        token += strlen(COOKIEPREFIX);
+        if((len = strcspn(token, "; ")) == sizeof(session_id_t) - 1) {
+            memcpy(session_id, token, len);
+            (*session_id)[len] = '\0';
+        } else
+            token = NULL;
+    }
+
+    return token ? session_id : NULL;
+}
+
+static bool unlink_session (httpd_req_t *req)
+{
+    webui_auth_t *session = NULL;
+    session_id_t session_id;
+
+    if(get_session_id(req, &session_id) && (session = session_find(&session_id)))
+        session->level = WebUIAuth_None;
+
+    return session != NULL;
 }
 
 static webui_auth_level_t get_auth_level (httpd_req_t *req)
@@ -1035,18 +1686,7 @@ esp_err_t webui_login_handler (httpd_req_t *req)
 
         if(auth_level != WebUIAuth_None) {
 
-            webui_auth_t *session;
-
-            if((session = malloc(sizeof(webui_auth_t)))) {
-                memset(session, 0, sizeof(webui_auth_t));
-                memcpy(&session->ip, get_ipaddress(req), sizeof(struct sockaddr_in6));
-                memcpy(session->session_id, create_session_id(&session->ip), sizeof(session_id_t));
-                session->level = auth_level;
-                strcpy(session->user_id, user);
-                session->last_access = xTaskGetTickCount();
-                session->next = sessions;
-                sessions = session;
-            }
+            webui_auth_t *session = session_add(get_ipaddress(req), auth_level, user);
 
             httpd_resp_set_hdr(req, "Set-Cookie", strcat(strcat(strcpy(cookie, COOKIEPREFIX), session->session_id), "; path=/"));
         }
@@ -1090,7 +1730,7 @@ esp_err_t webui_index_html_get_handler (httpd_req_t *req)
     extern const unsigned char index_html_gz_end[]   asm("_binary_index_html_gz_end");
     set_content_type_from_file(req, "index.html");
     httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-    return httpd_resp_send(req, (const char *)index_html_gz_start, index_html_gz_end - index_html_gz_start);
+    return http_send_asset(req, index_html_gz_start, index_html_gz_end, ETAG(INDEX_HTML_GZ_ETAG), HTTP_CACHE_REVALIDATE);
 }
 
 #endif
@@ -48,7 +48,6 @@ typedef struct webui_auth {
     user_id_t user_id;
     session_id_t session_id;
     TickType_t last_access;
-    struct webui_auth *next;
 } webui_auth_t;
 
 esp_err_t webui_http_command_handler (httpd_req_t *req);
@@ -0,0 +1,456 @@
+/*
+  frametest.c - host loopback test for the framed streaming protocol
+
+  Frames are built with frame_encode() and passed through the UART interrupt handler
+  to the frame decoder, input is read back with the stream read function which also
+  transmits the ack/nak responses. The driver sources are built unmodified for the
+  host, see ../host.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "driver.h"
+#include "framing.h"
+#include "host.h"
+
+#define CHECK(cond) check(cond, #cond, __LINE__)
+
+typedef struct {
+    frame_type_t type;
+    uint8_t seq;
+    uint8_t length;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint16_t rx_free;
+} response_t;
+
+static const char *test_name;
+static uint32_t failures = 0;
+static char input[RX_BUFFER_SIZE + 1];
+
+static bool check (bool ok, const char *cond, int line)
+{
+    if(!ok) {
+        failures++;
+        fprintf(stderr, "%s:%d: %s failed\n", test_name, line, cond);
+    }
+
+    return ok;
+}
+
+static void send (const void *data, uint16_t length)
+{
+    uart_host_rx((const uint8_t *)data, length);
+}
+
+static void send_string (const char *s)
+{
+    send(s, strlen(s));
+}
+
+static uint_fast16_t encode (uint8_t *frame, frame_type_t type, uint8_t seq, const void *payload, uint8_t length)
+{
+    return frame_encode(frame, type, seq, (const uint8_t *)payload, length);
+}
+
+static void send_frame (frame_type_t type, uint8_t seq, const void *payload, uint8_t length)
+{
+    uint8_t frame[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];
+
+    send(frame, encode(frame, type, seq, payload, length));
+}
+
+static void send_data (uint8_t seq, const char *payload)
+{
+    send_frame(FrameType_Data, seq, payload, strlen(payload));
+}
+
+// Reads the stream until empty, returns the input received.
+static const char *read_input (void)
+{
+    int16_t c;
+    uint_fast16_t length = 0;
+
+    while(length < RX_BUFFER_SIZE && (c = uart_host_read()) != -1)
+        input[length++] = (char)c;
+
+    input[length] = '\0';
+
+    return input;
+}
+
+// Decodes the response transmitted by the last read, returns false if none or malformed.
+static bool get_response (response_t *response)
+{
+    uint8_t tx[FRAME_MAX_PAYLOAD + FRAME_OVERHEAD];
+    uint16_t length = uart_host_tx(tx, sizeof(tx)), crc = 0xFFFF;
+
+    memset(response, 0, sizeof(response_t));
+
+    if(length < FRAME_OVERHEAD || tx[0] != FRAME_SOH || tx[3] + FRAME_OVERHEAD != length)
+        return false;
+
+    for(uint_fast16_t i = 1; i < length - 2; i++)
+        crc = frame_crc16(crc, tx[i]);
+
+    if(crc != (tx[length - 2] | (tx[length - 1] << 8)))
+        return false;
+
+    response->type = (frame_type_t)tx[1];
+    response->seq = tx[2];
+    response->length = tx[3];
+    memcpy(response->payload, &tx[4], response->length);
+
+    if(response->length >= 2)
+        response->rx_free = response->payload[response->length - 2] | (response->payload[response->length - 1] << 8);
+
+    return true;
+}
+
+// Reads the stream and checks for the expected response, input is left in the input buffer.
+static bool expect (frame_type_t type, uint8_t seq)
+{
+    response_t response;
+
+    read_input();
+
+    return get_response(&response) && response.type == type && response.seq == seq;
+}
+
+static void hello (void)
+{
+    send_frame(FrameType_Hello, FRAME_HELLO_SEQ, NULL, 0);
+    CHECK(expect(FrameType_Hello, 0));
+}
+
+static void test_plain (void)
+{
+    response_t response;
+
+    CHECK(!strcmp(read_input(), ""));
+
+    send_string("G0 X1\n");
+    CHECK(!strcmp(read_input(), "G0 X1\n"));
+    CHECK(!get_response(&response));
+    CHECK(!uart_host_framed());
+
+    // A well formed data frame is not decoded before the handshake.
+    send_data(0, "G1\n");
+    read_input();
+    CHECK(!uart_host_framed());
+    CHECK(!get_response(&response));
+}
+
+static void test_hello (void)
+{
+    uint64_t realtime = host_realtime_count;
+    uint8_t frame[FRAME_OVERHEAD];
+    response_t response;
+
+    CHECK(encode(frame, FrameType_Hello, FRAME_HELLO_SEQ, NULL, 0) == FRAME_OVERHEAD);
+    CHECK((frame[4] | (frame[5] << 8)) == FRAME_HELLO_CRC);
+
+    send(frame, FRAME_OVERHEAD);
+    CHECK(uart_host_framed());
+    CHECK(host_realtime_count == realtime);
+    CHECK(!strcmp(read_input(), ""));
+    CHECK(get_response(&response));
+    CHECK(response.type == FrameType_Hello && response.seq == 0 && response.length == 4);
+    CHECK(response.payload[0] == FRAME_VERSION && response.payload[1] == FRAME_MAX_PAYLOAD);
+    CHECK(response.rx_free == RX_BUFFER_SIZE - 1);
+
+    send_data(0, "G0 X1\n");
+    CHECK(expect(FrameType_Ack, 0));
+    CHECK(!strcmp(input, "G0 X1\n"));
+
+    // A repeated hello restarts the sequence.
+    hello();
+    send_data(0, "G0 X2\n");
+    CHECK(expect(FrameType_Ack, 0));
+    CHECK(!strcmp(input, "G0 X2\n"));
+}
+
+static void test_partial_hello (void)
+{
+    static const uint8_t partial[] = { FRAME_SOH, FrameType_Hello, FRAME_HELLO_SEQ };
+    uint8_t frame[FRAME_OVERHEAD];
+
+    encode(frame, FrameType_Hello, FRAME_HELLO_SEQ, NULL, 0);
+
+    // Handshake prefix followed by plain text: the text is not held back.
+    send(partial, sizeof(partial));
+    send_string("G1 X1\n");
+    CHECK(!strcmp(read_input(), "G1 X1\n"));
+    CHECK(!uart_host_framed());
+
+    // Prefix with a corrupted byte then a complete hello.
+    send(frame, 3);
+    send_string("\x7F");
+    send(frame, FRAME_OVERHEAD);
+    CHECK(uart_host_framed());
+    CHECK(expect(FrameType_Hello, 0));
+    CHECK(!strcmp(input, "\x7F"));
+
+    uart_host_reset();
+
+    // Prefix, line idle for longer than the timeout, then a complete hello.
+    send(partial, sizeof(partial));
+    host_ticks += FRAME_TIMEOUT + 1;
+    send(frame, FRAME_OVERHEAD);
+    CHECK(uart_host_framed());
+    CHECK(expect(FrameType_Hello, 0));
+
+    uart_host_reset();
+
+    // Hello with bad crc.
+    frame[5] ^= 0x01;
+    send(frame, FRAME_OVERHEAD);
+    CHECK(!uart_host_framed());
+}
+
+static void test_resync (void)
+{
+    static const uint8_t partial[] = { FRAME_SOH, FrameType_Hello };
+    uint8_t frame[FRAME_OVERHEAD + 4];
+    uint_fast16_t length;
+
+    // A handshake prefix followed by a complete hello, e.g. when a host retries after a failed open.
+    send(partial, sizeof(partial));
+    send_frame(FrameType_Hello, FRAME_HELLO_SEQ, NULL, 0);
+    CHECK(uart_host_framed());
+    CHECK(expect(FrameType_Hello, 0));
+    CHECK(!strcmp(input, ""));
+
+    // Noise between frames is discarded, realtime commands are not.
+    uint64_t realtime = host_realtime_count;
+    send_string("noise\n?");
+    send_data(0, "G1\n");
+    CHECK(expect(FrameType_Ack, 0));
+    CHECK(!strcmp(input, "G1\n"));
+    CHECK(host_realtime_count == realtime + 1);
+
+    // Truncated frame: the start of the next frame completes it and both are lost.
+    // The host resends after the line has been idle for the timeout.
+    length = encode(frame, FrameType_Data, 1, "G2\n", 3);
+    send(frame, length - 2);
+    send(frame, length);
+    CHECK(expect(FrameType_Nak, 1));
+    CHECK(!strcmp(input, ""));
+    host_ticks += FRAME_TIMEOUT + 1;
+    send(frame, length);
+    CHECK(expect(FrameType_Ack, 1));
+    CHECK(!strcmp(input, "G2\n"));
+}
+
+static void test_crc (void)
+{
+    uint8_t frame[FRAME_OVERHEAD + 8];
+    uint_fast16_t length;
+
+    hello();
+
+    // Bad checksum.
+    length = encode(frame, FrameType_Data, 0, "G0 X10\n", 7);
+    frame[length - 1] ^= 0x80;
+    send(frame, length);
+    CHECK(expect(FrameType_Nak, 0));
+    CHECK(!strcmp(input, ""));
+
+    // Corrupted payload.
+    length = encode(frame, FrameType_Data, 0, "G0 X10\n", 7);
+    frame[6] = '2';
+    send(frame, length);
+    CHECK(expect(FrameType_Nak, 0));
+    CHECK(!strcmp(input, ""));
+
+    // Corrupted length, the frame ends early and the remaining bytes are discarded.
+    length = encode(frame, FrameType_Data, 0, "G0 X10\n", 7);
+    frame[3] = 3;
+    send(frame, length);
+    CHECK(expect(FrameType_Nak, 0));
+    CHECK(!strcmp(input, ""));
+    host_ticks += FRAME_TIMEOUT + 1;
+
+    // Resent intact.
+    length = encode(frame, FrameType_Data, 0, "G0 X10\n", 7);
+    send(frame, length);
+    CHECK(expect(FrameType_Ack, 0));
+    CHECK(!strcmp(input, "G0 X10\n"));
+}
+
+static void test_window (void)
+{
+    char payload[FRAME_MAX_PAYLOAD + 1];
+    response_t response;
+    uint8_t seq;
+
+    hello();
+
+    memset(payload, 'x', FRAME_MAX_PAYLOAD);
+    payload[FRAME_MAX_PAYLOAD] = '\0';
+
+    // The ack reports the free space left after the frame.
+    send_data(0, payload);
+    CHECK(uart_host_read() == 'x');
+    CHECK(get_response(&response));
+    CHECK(response.type == FrameType_Ack && response.seq == 0);
+    CHECK(response.rx_free == RX_BUFFER_SIZE - 1 - FRAME_MAX_PAYLOAD);
+    read_input();
+
+    // Frames in flight without reading, the one that does not fit is rejected as a whole.
+    for(seq = 1; seq <= (RX_BUFFER_SIZE - 1) / FRAME_MAX_PAYLOAD; seq++)
+        send_data(seq, payload);
+
+    send_data(seq, payload);
+    CHECK(expect(FrameType_Nak, seq));
+    CHECK(strlen(input) == (seq - 1) * FRAME_MAX_PAYLOAD);
+
+    send_data(seq, "G4 P0\n");
+    CHECK(expect(FrameType_Ack, seq));
+    CHECK(!strcmp(input, "G4 P0\n"));
+}
+
+static void test_seq_wrap (void)
+{
+    char payload[16];
+    uint_fast16_t i;
+    bool ok = true;
+
+    hello();
+
+    for(i = 0; i < 300; i++) {
+        sprintf(payload, "N%u\n", (unsigned)i);
+        send_data((uint8_t)i, payload);
+        ok = ok && expect(FrameType_Ack, (uint8_t)i) && !strcmp(input, payload);
+    }
+
+    CHECK(ok);
+
+    // Expected seq is now 300 & 0xFF = 44.
+
+    // Duplicate from before the wrap, its ack was lost: acked again but not buffered.
+    send_data(255, "N255\n");
+    CHECK(expect(FrameType_Ack, 43));
+    CHECK(!strcmp(input, ""));
+
+    send_data(43, "N299\n");
+    CHECK(expect(FrameType_Ack, 43));
+    CHECK(!strcmp(input, ""));
+
+    // Frame ahead of the expected one, e.g. an earlier frame was lost.
+    send_data(45, "N301\n");
+    CHECK(expect(FrameType_Nak, 44));
+    CHECK(!strcmp(input, ""));
+
+    send_data(44, "N300\n");
+    CHECK(expect(FrameType_Ack, 44));
+    CHECK(!strcmp(input, "N300\n"));
+}
+
+static void test_compressed (void)
+{
+    static const uint8_t line[] = { 0x80, 0x9C, '1', '.', '5', 0xA2, '1', '2', 0xAD };
+    static const uint8_t unknown[] = { 0x81, 0x9C, '1', 0xFF, 0xAD };
+
+    hello();
+
+    send_frame(FrameType_DataCompressed, 0, line, sizeof(line));
+    CHECK(expect(FrameType_Ack, 0));
+    CHECK(!strcmp(input, "G0 X1.5 F12\n"));
+
+    // Tokens are not expanded in uncompressed data frames, the characters are passed on as is.
+    send_frame(FrameType_Data, 1, line, 2);
+    CHECK(expect(FrameType_Ack, 1));
+    CHECK(!strcmp(input, "\x80\x9C"));
+
+    // Unknown token, rejected as a whole.
+    send_frame(FrameType_DataCompressed, 2, unknown, sizeof(unknown));
+    CHECK(expect(FrameType_Nak, 2));
+    CHECK(!strcmp(input, ""));
+
+    // Expansion that does not fit, rejected as a whole.
+    uint8_t tokens[FRAME_MAX_PAYLOAD];
+    memset(tokens, 0x8B, sizeof(tokens)); // "G38.2"
+    for(uint8_t seq = 2; seq < 4; seq++)
+        send_frame(FrameType_DataCompressed, seq, tokens, sizeof(tokens));
+    CHECK(expect(FrameType_Nak, 3));
+    CHECK(strlen(input) == 5 * FRAME_MAX_PAYLOAD);
+}
+
+static void test_bye (void)
+{
+    uint64_t realtime;
+    response_t response;
+
+    hello();
+
+    send_data(0, "G0\n");
+    CHECK(expect(FrameType_Ack, 0));
+
+    // Plain text is discarded in framed mode.
+    send_string("G1\n");
+    CHECK(!strcmp(read_input(), ""));
+
+    send_frame(FrameType_Bye, 1, NULL, 0);
+    CHECK(expect(FrameType_Ack, 1));
+    CHECK(!uart_host_framed());
+
+    realtime = host_realtime_count;
+    send_string("G2\n!");
+    CHECK(!strcmp(read_input(), "G2\n"));
+    CHECK(host_realtime_count == realtime + 1);
+
+    // Data frames are not decoded after bye.
+    send_data(1, "G3\n");
+    read_input();
+    CHECK(!get_response(&response));
+    CHECK(!uart_host_framed());
+}
+
+static void run (const char *name, void (*test)(void))
+{
+    uint32_t failed = failures;
+
+    test_name = name;
+    uart_host_reset();
+    test();
+
+    printf("%-20s %s\n", name, failures == failed ? "ok" : "FAILED");
+}
+
+int main (int argc, char **argv)
+{
+    uart_host_init();
+
+    run("plain", test_plain);
+    run("hello", test_hello);
+    run("partial hello", test_partial_hello);
+    run("resync", test_resync);
+    run("crc", test_crc);
+    run("window", test_window);
+    run("seq wrap", test_seq_wrap);
+    run("compressed", test_compressed);
+    run("bye", test_bye);
+
+    if(failures)
+        printf("%u check(s) failed\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+/*
+  bluetooth.c - host build of the Bluetooth stream, see host.h
+
+  The controller and Bluedroid APIs are no-ops, see ./stubs/idf.h. Received data
+  is passed to the transport RX callback as the SPP and BLE implementations do.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../main/bluetooth.c"
+
+#include "host.h"
+
+// bluetooth_le.c is not built for the host.
+
+bool bluetooth_le_init (const char *device_name)
+{
+    return false;
+}
+
+void bluetooth_le_deinit (void)
+{
+}
+
+bool bt_host_rx (const uint8_t *data, uint16_t length)
+{
+    rxbuffer.overflow = false;
+
+    bluetooth_rx_data(data, length);
+
+    return !rxbuffer.overflow;
+}
+
+int16_t bt_host_read (void)
+{
+    return BTStreamGetC();
+}
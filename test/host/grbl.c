@@ -0,0 +1,65 @@
+/*
+  grbl.c - host stand-ins for the grblHAL core globals used by the stream drivers
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "grbl/hal.h"
+
+#include "host.h"
+
+volatile uint32_t host_ticks = 0;
+uint64_t host_realtime_count = 0;
+
+static uint32_t get_elapsed_ticks (void)
+{
+    return host_ticks;
+}
+
+static bool stream_blocking_callback (void)
+{
+    return true;
+}
+
+static void register_pin (const periph_pin_t *pin)
+{
+}
+
+grbl_hal_t hal = {
+    .get_elapsed_ticks = get_elapsed_ticks,
+    .stream_blocking_callback = stream_blocking_callback,
+    .periph_port.register_pin = register_pin
+};
+
+grbl_t grbl = {0};
+
+// As the core: the realtime command characters and anything with the top bit set are not buffered.
+bool host_is_realtime (char c)
+{
+    return c == CMD_RESET || c == CMD_STATUS_REPORT || c == CMD_CYCLE_START || c == CMD_FEED_HOLD || (uint8_t)c >= 0x80;
+}
+
+bool protocol_enqueue_realtime_command (char c)
+{
+    bool ok;
+
+    if((ok = host_is_realtime(c)))
+        __atomic_fetch_add(&host_realtime_count, 1, __ATOMIC_RELAXED);
+
+    return ok;
+}
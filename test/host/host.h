@@ -0,0 +1,53 @@
+/*
+  host.h - host test access to the stream drivers
+
+  The UART and Bluetooth stream drivers are built unmodified against the stubs in
+  ./stubs, uart.c and bluetooth.c include the driver sources and expose their
+  receive interrupt/callback and stream read functions to the tests.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// grbl.c, core stand-ins
+
+extern volatile uint32_t host_ticks;            // returned by hal.get_elapsed_ticks()
+extern uint64_t host_realtime_count;            // realtime commands taken by protocol_enqueue_realtime_command()
+
+bool host_is_realtime (char c);
+
+// uart.c, primary UART stream (esp32-hal-uart.c)
+
+void uart_host_init (void);
+void uart_host_reset (void);
+bool uart_host_rx (const uint8_t *data, uint16_t length);   // runs the RX interrupt handler, returns false on overflow
+int16_t uart_host_read (void);                              // stream read, sends pending frame responses
+uint16_t uart_host_tx (uint8_t *data, uint16_t size);       // returns and clears the transmitted data
+bool uart_host_framed (void);
+
+// bluetooth.c, Bluetooth stream (bluetooth.c)
+
+bool bt_host_rx (const uint8_t *data, uint16_t length);     // runs the transport RX callback, returns false on overflow
+int16_t bt_host_read (void);                                // stream read
+
+#endif
@@ -0,0 +1,313 @@
+/*
+  hal.h - minimal host stand-in for the grblHAL core headers
+
+  Only provides what driver.h and the stream code built by the host tests needs,
+  the other grbl header stubs include this file. hal, grbl and
+  protocol_enqueue_realtime_command() are provided by ../../grbl.c.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ISR_CODE
+#define PROGMEM
+
+#define On  1
+#define Off 0
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define ASCII_CAN   0x18
+#define ASCII_LF    '\n'
+#define ASCII_EOL   "\r\n"
+
+#define CMD_RESET           0x18
+#define CMD_STATUS_REPORT   '?'
+#define CMD_CYCLE_START     '~'
+#define CMD_FEED_HOLD       '!'
+#define CMD_TOOL_ACK        0xA3
+
+#ifndef RX_BUFFER_SIZE
+#define RX_BUFFER_SIZE 1024 // must be a power of 2
+#endif
+
+#define BUFCOUNT(head, tail, size) ((head >= tail) ? (head - tail) : (size - tail + head))
+
+#define BLUETOOTH_DEVICE    "GRBL"
+#define BLUETOOTH_SERVICE   "GRBL Serial Port"
+
+// As in grbl/stream.h
+
+typedef enum {
+    StreamType_Serial = 0,
+    StreamType_MPG,
+    StreamType_Bridge,
+    StreamType_Telnet,
+    StreamType_WebSocket,
+    StreamType_SDCard,
+    StreamType_Bluetooth,
+    StreamType_Null
+} stream_type_t;
+
+typedef struct {
+    volatile uint_fast16_t head;
+    volatile uint_fast16_t tail;
+    bool overflow;
+    bool rts_state;
+    bool backup;
+    char data[RX_BUFFER_SIZE];
+} stream_rx_buffer_t;
+
+typedef bool (*enqueue_realtime_command_ptr)(char data);
+
+typedef struct {
+    stream_type_t type;
+    struct {
+        uint8_t connected: 1;
+    } state;
+    int16_t (*read)(void);
+    void (*write)(const char *s);
+    void (*write_all)(const char *s);
+    void (*write_n)(const char *s, uint16_t length);
+    bool (*write_char)(const char c);
+    bool (*enqueue_rt_command)(char c);
+    uint16_t (*get_rx_buffer_free)(void);
+    uint16_t (*get_rx_buffer_count)(void);
+    uint16_t (*get_tx_buffer_count)(void);
+    void (*reset_write_buffer)(void);
+    void (*reset_read_buffer)(void);
+    void (*cancel_read_buffer)(void);
+    bool (*suspend_read)(bool suspend);
+    bool (*set_baud_rate)(uint32_t baud_rate);
+    bool (*disable_rx)(bool disable);
+    enqueue_realtime_command_ptr (*set_enqueue_rt_handler)(enqueue_realtime_command_ptr handler);
+} io_stream_t;
+
+typedef const io_stream_t *(*stream_claim_ptr)(uint32_t baud_rate);
+
+typedef struct {
+    stream_type_t type;
+    uint8_t instance;
+    struct {
+        uint8_t claimable: 1;
+        uint8_t claimed: 1;
+        uint8_t connected: 1;
+        uint8_t can_set_baud: 1;
+        uint8_t rx_only: 1;
+        uint8_t modbus_ready: 1;
+    } flags;
+    stream_claim_ptr claim;
+} io_stream_properties_t;
+
+typedef struct {
+    uint8_t n_streams;
+    io_stream_properties_t *streams;
+} io_stream_details_t;
+
+static inline void stream_register_streams (io_stream_details_t *details)
+{
+}
+
+static inline bool stream_connect (const io_stream_t *stream)
+{
+    return true;
+}
+
+static inline void stream_disconnect (const io_stream_t *stream)
+{
+}
+
+static inline bool stream_rx_suspend (stream_rx_buffer_t *rxbuffer, bool suspend)
+{
+    return false;
+}
+
+// As in grbl/crossbar.h
+
+typedef uint8_t pin_function_t;
+typedef uint8_t pin_group_t;
+typedef uint8_t pin_irq_mode_t;
+typedef uint8_t pin_mode_t;
+typedef void (*ioport_interrupt_callback_ptr)(uint8_t port, bool state);
+
+#define Input_RX        0x40
+#define Output_TX       0x80
+#define PinGroup_UART   0x20
+#define PinGroup_UART2  0x21
+#define PINMODE_NONE    0
+#define PINMODE_OUTPUT  (1 << 1)
+
+typedef struct {
+    pin_function_t function;
+    pin_group_t group;
+    uint8_t pin;
+    struct {
+        uint16_t mask;
+    } mode;
+    const char *description;
+} periph_pin_t;
+
+// As in grbl/nvs_buffer.h and grbl/settings.h
+
+typedef uint32_t nvs_address_t;
+
+typedef enum {
+    NVS_TransferResult_OK = 0,
+    NVS_TransferResult_Failed
+} nvs_transfer_result_t;
+
+typedef enum {
+    Group_Root = 0,
+    Group_Bluetooth = 26
+} setting_group_t;
+
+typedef enum {
+    Setting_BlueToothDeviceName = 73,
+    Setting_BlueToothServiceName = 74,
+    Setting_UserDefined_9 = 459
+} setting_id_t;
+
+typedef enum {
+    Format_String = 7,
+    Format_RadioButtons = 3
+} setting_datatype_t;
+
+typedef enum {
+    Setting_NonCore = 0
+} setting_type_t;
+
+typedef enum {
+    Status_BTInitError = 71
+} status_code_t;
+
+#define SETTINGS_HARD_RESET_REQUIRED "\\n\\nNOTE: A hard reset of the controller is required after changing this setting."
+
+typedef struct {
+    char device_name[33];
+    char service_name[33];
+} bluetooth_settings_t;
+
+typedef struct {
+    setting_group_t parent;
+    setting_group_t id;
+    const char *name;
+} setting_group_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    setting_group_t group;
+    const char *name;
+    const char *unit;
+    setting_datatype_t datatype;
+    const char *format;
+    const char *min_value;
+    const char *max_value;
+    setting_type_t type;
+    const void *value;
+    const void *get_value;
+    const void *is_available;
+} setting_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    const char *description;
+} setting_descr_t;
+
+typedef struct {
+    status_code_t id;
+    const char *description;
+} status_detail_t;
+
+typedef struct {
+    const status_detail_t *errors;
+    uint8_t n_errors;
+} error_details_t;
+
+typedef struct {
+    const setting_group_detail_t *groups;
+    uint8_t n_groups;
+    const setting_detail_t *settings;
+    uint8_t n_settings;
+    const setting_descr_t *descriptions;
+    uint8_t n_descriptions;
+    void (*save)(void);
+    void (*load)(void);
+    void (*restore)(void);
+} setting_details_t;
+
+static inline nvs_address_t nvs_alloc (size_t size)
+{
+    return 0;
+}
+
+static inline void errors_register (error_details_t *details)
+{
+}
+
+static inline void settings_register (setting_details_t *details)
+{
+}
+
+// Types referenced by driver.h only
+
+typedef uint8_t grbl_wifi_mode_t;
+typedef struct { uint8_t dummy; } wifi_sta_settings_t;
+typedef struct { uint8_t dummy; } wifi_ap_settings_t;
+typedef char password_t[33];
+
+// As in grbl/hal.h and grbl/core_handlers.h
+
+typedef void (*on_report_options_ptr)(bool newopt);
+
+typedef struct {
+    on_report_options_ptr on_report_options;
+} grbl_t;
+
+typedef struct {
+    io_stream_t stream;
+    bool (*stream_blocking_callback)(void);
+    uint32_t (*get_elapsed_ticks)(void);
+    struct {
+        void (*register_pin)(const periph_pin_t *pin);
+    } periph_port;
+    struct {
+        nvs_transfer_result_t (*memcpy_from_nvs)(uint8_t *dest, uint32_t source, uint32_t size, bool with_checksum);
+        nvs_transfer_result_t (*memcpy_to_nvs)(uint32_t dest, uint8_t *source, uint32_t size, bool with_checksum);
+    } nvs;
+    struct {
+        uint32_t bluetooth: 1;
+    } driver_cap;
+} grbl_hal_t;
+
+extern grbl_hal_t hal;
+extern grbl_t grbl;
+
+bool protocol_enqueue_realtime_command (char c);
+
+#endif
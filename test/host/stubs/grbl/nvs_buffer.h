@@ -0,0 +1,3 @@
+// Host stub, see hal.h
+
+#include "hal.h"
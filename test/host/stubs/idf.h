@@ -0,0 +1,546 @@
+/*
+  idf.h - minimal host stand-in for the ESP-IDF and FreeRTOS headers
+
+  Only provides what the stream code built by the host tests needs, the ESP-IDF
+  header stubs in this directory include this file. Functions that are called
+  but not under test are no-ops.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _IDF_H_
+#define _IDF_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// esp_attr.h
+
+#define DRAM_ATTR
+#define IRAM_ATTR
+
+// esp_err.h
+
+typedef int esp_err_t;
+
+#define ESP_OK   0
+#define ESP_FAIL -1
+
+static inline const char *esp_err_to_name (esp_err_t code)
+{
+    return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+// esp_log.h
+
+#define ESP_LOGE(tag, format, ...) do { (void)(tag); } while(0)
+#define ESP_LOGI(tag, format, ...) do { (void)(tag); } while(0)
+
+static inline void esp_log_buffer_hex (const char *tag, const void *buffer, uint16_t length)
+{
+}
+
+// FreeRTOS, handles are distinct types as in the real headers
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t EventBits_t;
+typedef struct tskTaskControlBlock *TaskHandle_t;
+typedef struct QueueDefinition *QueueHandle_t;
+typedef QueueHandle_t xQueueHandle;
+typedef QueueHandle_t SemaphoreHandle_t;
+typedef QueueHandle_t xSemaphoreHandle;
+typedef struct EventGroupDef_t *EventGroupHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct {
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0, 0 }
+#define portMAX_DELAY       (TickType_t)0xFFFFFFFF
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
+#define pdFALSE             0
+#define pdTRUE              1
+#define pdFAIL              pdFALSE
+#define pdPASS              pdTRUE
+
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux)  ((void)(mux))
+
+static inline BaseType_t xTaskCreatePinnedToCore (TaskFunction_t task, const char *name, uint32_t stack_depth, void *params,
+                                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    return pdFAIL;
+}
+
+static inline void vTaskDelete (TaskHandle_t task)
+{
+}
+
+static inline void vTaskDelay (TickType_t ticks)
+{
+}
+
+static inline void xTaskNotifyGive (TaskHandle_t task)
+{
+}
+
+static inline uint32_t ulTaskNotifyTake (BaseType_t clear, TickType_t wait)
+{
+    return 0;
+}
+
+static inline QueueHandle_t xQueueCreate (UBaseType_t length, UBaseType_t item_size)
+{
+    return NULL;
+}
+
+static inline void vQueueDelete (QueueHandle_t queue)
+{
+}
+
+static inline BaseType_t xQueueSendToBack (QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    return pdFAIL;
+}
+
+static inline BaseType_t xQueueReceive (QueueHandle_t queue, void *item, TickType_t wait)
+{
+    return pdFALSE;
+}
+
+static inline UBaseType_t uxQueueMessagesWaiting (QueueHandle_t queue)
+{
+    return 0;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateBinary (void)
+{
+    return NULL;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex (void)
+{
+    return NULL;
+}
+
+static inline void vSemaphoreDelete (SemaphoreHandle_t semaphore)
+{
+}
+
+static inline BaseType_t xSemaphoreTake (SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    return pdFALSE;
+}
+
+static inline BaseType_t xSemaphoreGive (SemaphoreHandle_t semaphore)
+{
+    return pdFALSE;
+}
+
+static inline EventGroupHandle_t xEventGroupCreate (void)
+{
+    return NULL;
+}
+
+static inline void vEventGroupDelete (EventGroupHandle_t group)
+{
+}
+
+static inline EventBits_t xEventGroupSetBits (EventGroupHandle_t group, EventBits_t bits)
+{
+    return 0;
+}
+
+static inline EventBits_t xEventGroupClearBits (EventGroupHandle_t group, EventBits_t bits)
+{
+    return 0;
+}
+
+static inline EventBits_t xEventGroupWaitBits (EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t wait)
+{
+    return 0;
+}
+
+// driver/gpio.h
+
+typedef uint8_t gpio_int_type_t;
+
+// Interrupts and peripheral registers
+
+typedef struct intr_handle_data_t *intr_handle_t;
+typedef void (*intr_handler_t)(void *arg);
+
+#define ESP_INTR_FLAG_IRAM      (1 << 10)
+#define ETS_UART0_INTR_SOURCE   34
+#define ETS_UART1_INTR_SOURCE   35
+#define ETS_UART2_INTR_SOURCE   36
+
+static inline esp_err_t esp_intr_alloc (int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *handle)
+{
+    return ESP_OK;
+}
+
+#define DR_REG_UART_BASE            0x3ff40000
+#define DR_REG_UART1_BASE           0x3ff50000
+#define DR_REG_UART2_BASE           0x3ff6e000
+#define UART_FIFO_REG(i)            (i)
+#define UART_CLK_FREQ               80000000
+#define UART_PIN_NO_CHANGE          (-1)
+
+#define DPORT_PERIP_CLK_EN_REG      0
+#define DPORT_PERIP_RST_EN_REG      1
+#define DPORT_UART_CLK_EN           (1 << 2)
+#define DPORT_UART1_CLK_EN          (1 << 5)
+#define DPORT_UART2_CLK_EN          (1 << 23)
+#define DPORT_UART_RST              (1 << 2)
+#define DPORT_UART1_RST             (1 << 5)
+#define DPORT_UART2_RST             (1 << 23)
+#define DPORT_SET_PERI_REG_MASK(reg, mask)      ((void)(reg), (void)(mask))
+#define DPORT_CLEAR_PERI_REG_MASK(reg, mask)    ((void)(reg), (void)(mask))
+#define READ_PERI_REG(reg)                      read_peri_reg(reg)
+
+static inline uint32_t read_peri_reg (uint32_t reg)
+{
+    return 0;
+}
+
+// UART registers, the host side of the FIFO is implemented by the test, see ../uart.c.
+// Reading the FIFO register pops a received byte in hardware, for this the register is
+// accessed through a function returning the location to read from or write to.
+
+#define rw_byte access()[0]
+
+typedef volatile struct {
+    union {
+        struct {
+            uint32_t rxfifo_full: 1;
+            uint32_t txfifo_empty: 1;
+            uint32_t parity_err: 1;
+            uint32_t frm_err: 1;
+            uint32_t rxfifo_ovf: 1;
+            uint32_t dsr_chg: 1;
+            uint32_t cts_chg: 1;
+            uint32_t brk_det: 1;
+            uint32_t rxfifo_tout: 1;
+            uint32_t sw_xon: 1;
+            uint32_t sw_xoff: 1;
+            uint32_t glitch_det: 1;
+            uint32_t tx_brk_done: 1;
+            uint32_t tx_brk_idle_done: 1;
+            uint32_t tx_done: 1;
+        };
+        uint32_t val;
+    } int_raw, int_st, int_ena, int_clr;
+    struct {
+        uint32_t div_int: 20;
+        uint32_t div_frag: 4;
+    } clk_div;
+    struct {
+        uint32_t rxfifo_cnt: 8;
+        uint32_t reserved: 8;
+        uint32_t txfifo_cnt: 8;
+    } status;
+    union {
+        struct {
+            uint32_t parity: 1;
+            uint32_t parity_en: 1;
+            uint32_t bit_num: 2;
+            uint32_t stop_bit_num: 2;
+        };
+        uint32_t val;
+    } conf0;
+    union {
+        struct {
+            uint32_t rxfifo_full_thrhd: 7;
+            uint32_t reserved0: 1;
+            uint32_t txfifo_empty_thrhd: 7;
+            uint32_t reserved1: 9;
+            uint32_t rx_tout_thrhd: 7;
+            uint32_t rx_tout_en: 1;
+        };
+        uint32_t val;
+    } conf1;
+    struct {
+        uint32_t en: 1;
+        uint32_t dl0_en: 1;
+        uint32_t dl1_en: 1;
+    } rs485_conf;
+    struct {
+        uint32_t rd_addr: 11;
+        uint32_t wr_addr: 11;
+    } mem_rx_status;
+    struct {
+        uint8_t *(*access)(void);
+    } fifo;
+} uart_dev_t;
+
+static inline esp_err_t uart_set_pin (int uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return ESP_OK;
+}
+
+// Bluetooth controller and Bluedroid
+
+#define ESP_BD_ADDR_LEN 6
+
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+typedef uint8_t esp_bt_pin_code_t[16];
+typedef uint8_t esp_bt_io_cap_t;
+
+typedef enum {
+    ESP_BT_MODE_IDLE = 0,
+    ESP_BT_MODE_BLE,
+    ESP_BT_MODE_CLASSIC_BT,
+    ESP_BT_MODE_BTDM
+} esp_bt_mode_t;
+
+typedef enum {
+    ESP_BT_CONTROLLER_STATUS_IDLE = 0,
+    ESP_BT_CONTROLLER_STATUS_INITED,
+    ESP_BT_CONTROLLER_STATUS_ENABLED
+} esp_bt_controller_status_t;
+
+typedef struct {
+    uint8_t mode;
+} esp_bt_controller_config_t;
+
+#define BT_CONTROLLER_INIT_CONFIG_DEFAULT() { .mode = ESP_BT_MODE_BTDM }
+
+static inline esp_bt_controller_status_t esp_bt_controller_get_status (void)
+{
+    return ESP_BT_CONTROLLER_STATUS_IDLE;
+}
+
+static inline esp_err_t esp_bt_controller_mem_release (esp_bt_mode_t mode)
+{
+    return ESP_FAIL;
+}
+
+static inline esp_err_t esp_bt_controller_init (esp_bt_controller_config_t *cfg)
+{
+    return ESP_FAIL;
+}
+
+static inline esp_err_t esp_bt_controller_deinit (void)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_controller_enable (esp_bt_mode_t mode)
+{
+    return ESP_FAIL;
+}
+
+static inline esp_err_t esp_bt_controller_disable (void)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bluedroid_init (void)
+{
+    return ESP_FAIL;
+}
+
+static inline esp_err_t esp_bluedroid_deinit (void)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bluedroid_enable (void)
+{
+    return ESP_FAIL;
+}
+
+static inline esp_err_t esp_bluedroid_disable (void)
+{
+    return ESP_OK;
+}
+
+static inline const uint8_t *esp_bt_dev_get_address (void)
+{
+    static const esp_bd_addr_t address = {0};
+
+    return address;
+}
+
+static inline esp_err_t esp_bt_dev_set_device_name (const char *name)
+{
+    return ESP_OK;
+}
+
+// Classic Bluetooth GAP
+
+#define ESP_BT_STATUS_SUCCESS       0
+#define ESP_BT_CONNECTABLE          1
+#define ESP_BT_GENERAL_DISCOVERABLE 2
+#define ESP_BT_SP_IOCAP_MODE        0
+#define ESP_BT_IO_CAP_IO            1
+#define ESP_BT_PIN_TYPE_VARIABLE    0
+#define ESP_BT_INIT_COD             0x0a
+
+typedef enum {
+    ESP_BT_GAP_AUTH_CMPL_EVT = 4,
+    ESP_BT_GAP_PIN_REQ_EVT,
+    ESP_BT_GAP_CFM_REQ_EVT,
+    ESP_BT_GAP_KEY_NOTIF_EVT,
+    ESP_BT_GAP_KEY_REQ_EVT
+} esp_bt_gap_cb_event_t;
+
+typedef union {
+    struct {
+        esp_bd_addr_t bda;
+        int stat;
+    } auth_cmpl;
+    struct {
+        esp_bd_addr_t bda;
+        bool min_16_digit;
+    } pin_req;
+    struct {
+        esp_bd_addr_t bda;
+        uint32_t num_val;
+    } cfm_req;
+    struct {
+        esp_bd_addr_t bda;
+        uint32_t passkey;
+    } key_notif;
+} esp_bt_gap_cb_param_t;
+
+typedef struct {
+    uint32_t reserved_2: 2;
+    uint32_t minor: 6;
+    uint32_t major: 5;
+    uint32_t service: 11;
+    uint32_t reserved_8: 8;
+} esp_bt_cod_t;
+
+typedef void (*esp_bt_gap_cb_t)(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param);
+
+static inline esp_err_t esp_bt_gap_register_callback (esp_bt_gap_cb_t callback)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_set_scan_mode (int connectable, int discoverable)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_set_security_param (int type, void *value, uint8_t length)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_set_pin (int type, uint8_t length, esp_bt_pin_code_t pin_code)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_pin_reply (esp_bd_addr_t bda, bool accept, uint8_t length, esp_bt_pin_code_t pin_code)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_ssp_confirm_reply (esp_bd_addr_t bda, bool accept)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_bt_gap_set_cod (esp_bt_cod_t cod, int mode)
+{
+    return ESP_OK;
+}
+
+// Serial Port Profile
+
+#define ESP_SPP_SEC_AUTHENTICATE    0x0012
+#define ESP_SPP_ROLE_SLAVE          1
+#define ESP_SPP_MODE_CB             0
+
+typedef enum {
+    ESP_SPP_INIT_EVT = 0,
+    ESP_SPP_CLOSE_EVT = 27,
+    ESP_SPP_OPEN_EVT = 26,
+    ESP_SPP_DATA_IND_EVT = 30,
+    ESP_SPP_CONG_EVT = 31,
+    ESP_SPP_WRITE_EVT = 33,
+    ESP_SPP_SRV_OPEN_EVT = 34
+} esp_spp_cb_event_t;
+
+typedef union {
+    struct {
+        uint32_t handle;
+    } open;
+    struct {
+        uint32_t handle;
+        esp_bd_addr_t rem_bda;
+    } srv_open;
+    struct {
+        uint32_t handle;
+        uint16_t len;
+        uint8_t *data;
+    } data_ind;
+    struct {
+        uint32_t handle;
+        bool cong;
+    } cong;
+    struct {
+        uint32_t handle;
+        int len;
+        bool cong;
+    } write;
+} esp_spp_cb_param_t;
+
+typedef void (*esp_spp_cb_t)(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
+
+static inline esp_err_t esp_spp_register_callback (esp_spp_cb_t callback)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_spp_init (int mode)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_spp_deinit (void)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_spp_start_srv (int sec_mask, int role, uint8_t local_scn, const char *name)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_spp_disconnect (uint32_t handle)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t esp_spp_write (uint32_t handle, int len, uint8_t *data)
+{
+    return ESP_FAIL;
+}
+
+#endif
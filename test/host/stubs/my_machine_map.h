@@ -0,0 +1 @@
+// Empty board map for the host tests.
@@ -0,0 +1,3 @@
+// Host stub, see idf.h
+
+#include "idf.h"
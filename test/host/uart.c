@@ -0,0 +1,115 @@
+/*
+  uart.c - host build of the primary UART stream, see host.h
+
+  The UART registers are emulated by ./stubs/idf.h, received data is placed in the
+  RX FIFO and the interrupt handler called directly. Data written to the FIFO
+  register from outside the interrupt handler is captured as transmitted.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "../../main/esp32-hal-uart.c"
+
+#include "host.h"
+
+#define HOST_RX_FIFO_SIZE 128
+#define HOST_TX_SIZE      256
+
+static uart_dev_t host_uart;
+static const uint8_t *rx_data;
+static __thread bool isr_context = false;
+static struct {
+    uint16_t length;
+    uint8_t data[HOST_TX_SIZE];
+} tx;
+
+static uint8_t *fifo_access (void)
+{
+    if(isr_context) {
+        host_uart.status.rxfifo_cnt--;
+        return (uint8_t *)rx_data++;
+    }
+
+    if(tx.length < HOST_TX_SIZE)
+        return &tx.data[tx.length++];
+
+    return &tx.data[HOST_TX_SIZE - 1]; // overrun, last byte is overwritten
+}
+
+void uart_host_init (void)
+{
+    host_uart.fifo.access = fifo_access;
+    _uart_bus_array[0].dev = &host_uart;
+
+    serialInit(115200);
+}
+
+void uart_host_reset (void)
+{
+    serialFlush();
+#if FRAMING_ENABLE
+    frame_reset(&framing);
+#endif
+    rxbuffer.overflow = false;
+    tx.length = 0;
+}
+
+bool uart_host_rx (const uint8_t *data, uint16_t length)
+{
+    uint16_t n;
+
+    isr_context = true;
+    rxbuffer.overflow = false;
+
+    while(length) {
+        n = min(length, HOST_RX_FIFO_SIZE);
+        rx_data = data;
+        host_uart.status.rxfifo_cnt = n;
+        _uart1_isr(NULL);
+        data += n;
+        length -= n;
+    }
+
+    isr_context = false;
+
+    return !rxbuffer.overflow;
+}
+
+int16_t uart_host_read (void)
+{
+    return serialRead();
+}
+
+uint16_t uart_host_tx (uint8_t *data, uint16_t size)
+{
+    uint16_t length = min(size, tx.length);
+
+    memcpy(data, tx.data, length);
+    tx.length = 0;
+
+    return length;
+}
+
+bool uart_host_framed (void)
+{
+#if FRAMING_ENABLE
+    return framing.enabled;
+#else
+    return false;
+#endif
+}
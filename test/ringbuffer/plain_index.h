@@ -0,0 +1,12 @@
+// Included ahead of every source for the plain variant, see Makefile. Replaces the
+// driver.h acquire/release index access with the original plain volatile loads and stores.
+
+#include "driver.h"
+
+#undef BUFFER_LOAD
+#undef BUFFER_STORE
+
+#define BUFFER_LOAD(idx)        (idx)
+#define BUFFER_STORE(idx, val)  ((idx) = (val))
+
+#define RING_INDEX "plain"
@@ -0,0 +1,230 @@
+/*
+  ringtest.c - host concurrency test and benchmark for the stream input buffers
+
+  Runs the UART interrupt handler or Bluetooth RX callback as producer and the stream
+  read function as consumer of the single producer/single consumer stream input buffer
+  on separate threads. The driver sources are built unmodified for the host, see ../host.
+  Build with ThreadSanitizer to check the head/tail discipline, see Makefile.
+
+  Part of grblHAL
+
+  Copyright (c) 2022 Terje Io
+
+  Grbl is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Grbl is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Grbl.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "driver.h"
+#include "host.h"
+
+#ifndef RING_INDEX
+#define RING_INDEX "driver" // BUFFER_LOAD/BUFFER_STORE from driver.h
+#endif
+
+typedef struct {
+    const char *name;
+    bool (*put)(const uint8_t *data, uint16_t length);
+    int16_t (*get)(void);
+} ring_impl_t;
+
+typedef struct {
+    const ring_impl_t *impl;
+    uint64_t length;
+    uint32_t seed;
+    bool jitter;
+    uint64_t received;
+    uint64_t errors;
+    uint64_t full;
+} ring_test_t;
+
+// Producers are the UART interrupt handler and the Bluetooth RX callback, consumers the stream read functions.
+// A producer returns false on overflow, the test then retries the character.
+static const ring_impl_t impls[] = {
+    { .name = "uart", .put = uart_host_rx, .get = uart_host_read },
+    { .name = "bluetooth", .put = bt_host_rx, .get = bt_host_read }
+};
+
+static inline uint32_t xorshift32 (uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+// Produces the random stream, about a quarter of the characters are realtime commands.
+// Both threads generate the same sequence from the seed.
+// CMD_TOOL_ACK is not produced as it swaps the Bluetooth input buffer.
+static inline char next_char (uint32_t *state)
+{
+    uint32_t r = xorshift32(state);
+
+    if((r & 0x700) == 0)
+        return (r & 0x7F) == (CMD_TOOL_ACK & 0x7F) ? CMD_FEED_HOLD : (char)(0x80 | (r & 0x7F));
+
+    return (r & 0x3800) == 0 ? "!?~\x18"[r & 0x03] : (char)(' ' + (r % 95));
+}
+
+static void *producer (void *arg)
+{
+    ring_test_t *test = (ring_test_t *)arg;
+    uint32_t state = test->seed, jitter = test->seed ^ 0x5A5A5A5A;
+    uint64_t length = test->length;
+
+    while(length--) {
+
+        char c = next_char(&state);
+
+        while(!test->impl->put((uint8_t *)&c, 1)) {
+            test->full++;
+            sched_yield();
+        }
+
+        // Random bursts and pauses for different interleavings
+        if(test->jitter && (xorshift32(&jitter) & 0x3FF) == 0)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static void *consumer (void *arg)
+{
+    ring_test_t *test = (ring_test_t *)arg;
+    uint32_t state = test->seed, jitter = test->seed ^ 0xA5A5A5A5;
+    uint64_t length = test->length;
+    int16_t c;
+
+    while(length--) {
+
+        char expected = next_char(&state);
+
+        if(host_is_realtime(expected))
+            continue;
+
+        while((c = test->impl->get()) == -1)
+            sched_yield();
+
+        if((char)c != expected && test->errors++ < 10)
+            fprintf(stderr, "%s: mismatch at %llu, got 0x%02X expected 0x%02X\n", test->impl->name,
+                     (unsigned long long)test->received, (uint8_t)c, (uint8_t)expected);
+
+        test->received++;
+
+        if(test->jitter && (xorshift32(&jitter) & 0x3FF) == 0)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+static double run (const ring_impl_t *impl, uint64_t length, uint32_t seed, bool jitter, ring_test_t *test)
+{
+    struct timespec t0, t1;
+    pthread_t tx, rx;
+
+    memset(test, 0, sizeof(ring_test_t));
+    test->impl = impl;
+    test->length = length;
+    test->seed = seed ? seed : 1;
+    test->jitter = jitter;
+    host_realtime_count = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pthread_create(&rx, NULL, consumer, test);
+    pthread_create(&tx, NULL, producer, test);
+    pthread_join(tx, NULL);
+    pthread_join(rx, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void usage (const char *cmd)
+{
+    fprintf(stderr, "usage: %s [-i uart|bluetooth] [-n bytes] [-r runs] [-s seed] [-b]\n"
+                    "  -b  benchmark: no jitter, report throughput for each implementation\n", cmd);
+    exit(2);
+}
+
+int main (int argc, char **argv)
+{
+    const ring_impl_t *impl = &impls[0];
+    uint64_t length = 4000000;
+    uint32_t runs = 4, seed = (uint32_t)time(NULL);
+    bool bench = false, ok = true;
+    ring_test_t test;
+    int i;
+
+    uart_host_init();
+
+    for(i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-b"))
+            bench = true;
+        else if(i + 1 == argc)
+            usage(argv[0]);
+        else if(!strcmp(argv[i], "-n"))
+            length = strtoull(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "-r"))
+            runs = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "-s"))
+            seed = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "-i")) {
+            impl = NULL;
+            i++;
+            for(int j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+                if(!strcmp(argv[i], impls[j].name))
+                    impl = &impls[j];
+            }
+            if(impl == NULL)
+                usage(argv[0]);
+        } else
+            usage(argv[0]);
+    }
+
+    if(bench) {
+        for(i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            double best = 0.0;
+            for(uint32_t r = 0; r < runs; r++) {
+                double t = run(&impls[i], length, seed + r, false, &test);
+                ok = ok && test.errors == 0;
+                if(best == 0.0 || t < best)
+                    best = t;
+            }
+            printf("%-10s %-7s %10.1f MB/s (best of %u, %llu bytes)\n", impls[i].name, RING_INDEX, (double)length / best / 1e6,
+                    runs, (unsigned long long)length);
+        }
+    } else for(uint32_t r = 0; r < runs; r++) {
+
+        double t = run(impl, length, seed + r, true, &test);
+
+        printf("%s (%s): seed %u, %llu bytes, %llu buffered, %llu realtime, %llu full, %llu errors, %.2f s\n", impl->name, RING_INDEX,
+                test.seed, (unsigned long long)length, (unsigned long long)test.received,
+                 (unsigned long long)host_realtime_count, (unsigned long long)test.full,
+                  (unsigned long long)test.errors, t);
+
+        ok = ok && test.errors == 0 && test.received + host_realtime_count == length;
+    }
+
+    return ok ? 0 : 1;
+}